@@ -0,0 +1,141 @@
+/**
+ * \file
+ * Group commit: batch the requests of many async subroutines into one
+ * flush.
+ *
+ * Each subroutine submits an item with await_batch() and waits. The batch
+ * is flushed as soon as it holds `max` items, or `window` time units after
+ * its first item arrived, whichever comes first; the flush callback sees
+ * every request in the batch and stores a result in each, and then all of
+ * the submitters resume.
+ *
+ *     static void write_all(void *ctx, struct async_batch_req **reqs, unsigned n) {
+ *       ... one write for all n items, then fsync once ...
+ *       for (i = 0; i < n; ++i)
+ *         reqs[i]->result = ok ? 0 : -1;
+ *     }
+ *     ...
+ *     await_batch(&batch, &st->req, st->record, async_clock_ns());
+ *     if (st->req.result != 0) ...
+ *
+ * As in async-flow.h, times come from the caller, and a batch is shared
+ * by the subroutines of one driver loop and is not thread-safe. The flush
+ * runs on that driver loop, inside whichever await noticed the batch was
+ * due.
+ */
+
+#ifndef ASYNC_BATCH_H
+#define ASYNC_BATCH_H
+
+#include <string.h>
+
+#include "async.h"
+
+#ifndef ASYNC_BATCH_MAX
+#define ASYNC_BATCH_MAX 64
+#endif
+
+/**
+ * One submitter's request. Must be part of the submitter's async state.
+ */
+struct async_batch_req {
+  void *item;
+  int result;
+  unsigned gen;               /* the batch this request joined */
+};
+
+typedef void (*async_batch_fn)(void *ctx, struct async_batch_req **reqs, unsigned n);
+
+struct async_batch {
+  async_batch_fn flush;
+  void *ctx;
+  unsigned max;
+  unsigned long long window;
+  unsigned long long deadline;
+  unsigned n;
+  unsigned gen;
+  struct async_batch_req *req[ASYNC_BATCH_MAX];
+};
+
+/**
+ * Initialize a batch
+ *
+ * \param b (struct async_batch *) The batch
+ * \param fn Called as fn(ctx, reqs, n) to flush n requests
+ * \param c Passed to fn
+ * \param size Flush once this many requests have joined, at most
+ * ASYNC_BATCH_MAX
+ * \param w Flush this long after the first request joined
+ */
+#define init_batch(b, fn, c, size, w)					\
+  do {									\
+    (b)->flush = (fn);							\
+    (b)->ctx = (c);							\
+    (b)->max = (size) < ASYNC_BATCH_MAX ? (size) : ASYNC_BATCH_MAX;	\
+    (b)->window = (w);							\
+    (b)->n = (b)->gen = 0;						\
+  } while(0)
+
+/**
+ * Flush the requests collected so far, if any, and start a new batch
+ */
+static inline void async_batch_flush(struct async_batch *b)
+{
+  struct async_batch_req *req[ASYNC_BATCH_MAX];
+  unsigned n = b->n;
+  if (n == 0)
+    return;
+  /* start the next batch first so the callback may already submit to it;
+   * the copy keeps those submissions from overwriting this batch */
+  memcpy(req, b->req, n * sizeof(req[0]));
+  b->n = 0;
+  ++b->gen;
+  b->flush(b->ctx, req, n);
+}
+
+/**
+ * Add a request to the current batch, flushing it if it is now full
+ */
+static inline void async_batch_join(struct async_batch *b, struct async_batch_req *r, void *item,
+                                    unsigned long long now)
+{
+  r->item = item;
+  r->result = 0;
+  r->gen = b->gen;
+  if (b->n == 0)
+    b->deadline = now + b->window;
+  b->req[b->n++] = r;
+  if (b->n >= b->max)
+    async_batch_flush(b);
+}
+
+/**
+ * Check whether a request's batch has been flushed, flushing it if its
+ * deadline has passed
+ */
+static inline int async_batch_poll(struct async_batch *b, struct async_batch_req *r, unsigned long long now)
+{
+  if (r->gen != b->gen)
+    return 1;
+  if (now < b->deadline)
+    return 0;
+  async_batch_flush(b);
+  return 1;
+}
+
+/**
+ * Submit an item to a batch and wait until the batch has been flushed
+ *
+ * \param b (struct async_batch *) The batch
+ * \param r (struct async_batch_req *) The request, from the async state;
+ * its result field holds the outcome once this returns
+ * \param item (void *) The item to submit
+ * \param now An expression yielding the current time
+ */
+#define await_batch(b, r, item, now)					\
+  do {									\
+    async_batch_join(b, r, item, now);					\
+    await(async_batch_poll(b, r, now));					\
+  } while(0)
+
+#endif /* ASYNC_BATCH_H */
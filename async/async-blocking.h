@@ -0,0 +1,264 @@
+/**
+ * \file
+ * Offload unavoidable blocking calls to a bounded worker thread pool.
+ *
+ * Some calls have no non-blocking form (getaddrinfo, stat on a slow file
+ * system, third-party libraries, compression). Calling them directly from
+ * an async subroutine stalls every other subroutine driven by the same loop.
+ * await_blocking() instead queues the call on a worker thread and parks the
+ * subroutine until the call has returned:
+ *
+ *     typedef struct {
+ *       async_state;
+ *       struct async_blocking job;
+ *       void *addr;
+ *     } resolve_state;
+ *
+ *     async resolve(resolve_state *st) {
+ *       async_begin(st);
+ *       await_blocking(&pool, &st->job, lookup_host, "example.com", st->addr);
+ *       ...
+ *       async_end;
+ *     }
+ *
+ * The job record lives in the caller's state, so submitting never allocates.
+ * The queue is bounded: when it is full, await_blocking() simply waits for
+ * room, which pushes back on the submitting subroutine rather than growing
+ * without limit.
+ */
+
+#ifndef ASYNC_BLOCKING_H
+#define ASYNC_BLOCKING_H
+
+#include "async-clock.h"
+#include "async-thread.h"
+#include "async.h"
+
+#ifndef ASYNC_POOL_MAX_THREADS
+#define ASYNC_POOL_MAX_THREADS 16
+#endif
+
+enum { ASYNC_BLOCKING_IDLE, ASYNC_BLOCKING_QUEUED, ASYNC_BLOCKING_DONE };
+
+/**
+ * A blocking call handed to the pool. Store one in the async state of
+ * every subroutine that uses await_blocking().
+ */
+struct async_blocking {
+  void *(*fn)(void *);
+  void *arg;
+  void *result;
+  struct async_blocking *next;
+  unsigned state;
+  unsigned rejected;            /* already counted as refused by a full queue */
+  unsigned long long queued_at;
+  unsigned long long queue_ns;  /* time spent waiting for a worker */
+  unsigned long long run_ns;    /* time spent inside fn */
+};
+
+/**
+ * Aggregate per-call latency statistics for a pool.
+ */
+struct async_pool_stats {
+  unsigned long long calls;
+  unsigned long long rejected;  /* calls that found the queue full, counted once each */
+  unsigned long long queue_ns, queue_ns_max;
+  unsigned long long run_ns, run_ns_max;
+  unsigned depth_max;
+};
+
+struct async_pool {
+  async_mutex lock;
+  async_cond wake;
+  async_thread threads[ASYNC_POOL_MAX_THREADS];
+  unsigned nthreads;
+  struct async_blocking *head, *tail;
+  unsigned depth, max_depth;
+  int stop;
+  struct async_pool_stats stats;
+};
+
+static inline async_thread_fn(async_pool_worker, p)
+{
+  struct async_pool *pool = (struct async_pool *)p;
+  struct async_blocking *job;
+  unsigned long long start, end;
+
+  async_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->head && !pool->stop)
+      async_cond_wait(&pool->wake, &pool->lock);
+    if (!pool->head)
+      break;
+    job = pool->head;
+    pool->head = job->next;
+    if (!pool->head)
+      pool->tail = NULL;
+    --pool->depth;
+    async_mutex_unlock(&pool->lock);
+
+    start = async_clock_ns();
+    job->result = job->fn(job->arg);
+    end = async_clock_ns();
+    job->queue_ns = start - job->queued_at;
+    job->run_ns = end - start;
+
+    async_mutex_lock(&pool->lock);
+    ++pool->stats.calls;
+    pool->stats.queue_ns += job->queue_ns;
+    pool->stats.run_ns += job->run_ns;
+    if (job->queue_ns > pool->stats.queue_ns_max)
+      pool->stats.queue_ns_max = job->queue_ns;
+    if (job->run_ns > pool->stats.run_ns_max)
+      pool->stats.run_ns_max = job->run_ns;
+    /* publish last: the submitter may reuse the job as soon as it sees this */
+    async_atomic_store(&job->state, ASYNC_BLOCKING_DONE);
+  }
+  async_mutex_unlock(&pool->lock);
+  async_thread_return;
+}
+
+/**
+ * Stop a worker pool
+ *
+ * Calls already queued are still run before the workers exit.
+ *
+ * \param pool (struct async_pool *) The pool to stop
+ */
+static inline void async_pool_destroy(struct async_pool *pool)
+{
+  unsigned i;
+  async_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  async_cond_broadcast(&pool->wake);
+  async_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->nthreads; ++i)
+    async_thread_join(pool->threads[i]);
+  async_cond_destroy(&pool->wake);
+  async_mutex_destroy(&pool->lock);
+}
+
+/**
+ * Start a worker pool
+ *
+ * \param pool (struct async_pool *) The pool to initialize
+ * \param nthreads The number of worker threads, at most ASYNC_POOL_MAX_THREADS
+ * \param max_depth The maximum number of queued calls not yet picked up
+ * by a worker
+ * \return 0 on success, or -1 if the threads could not be started, in
+ * which case the workers that did start have been stopped again and the
+ * pool must not be destroyed
+ */
+static inline int async_pool_init(struct async_pool *pool, unsigned nthreads, unsigned max_depth)
+{
+  unsigned i;
+  if (nthreads == 0 || nthreads > ASYNC_POOL_MAX_THREADS)
+    return -1;
+  async_mutex_init(&pool->lock);
+  async_cond_init(&pool->wake);
+  pool->nthreads = 0;
+  pool->head = pool->tail = NULL;
+  pool->depth = 0;
+  pool->max_depth = max_depth;
+  pool->stop = 0;
+  pool->stats = (struct async_pool_stats){ 0 };
+  for (i = 0; i < nthreads; ++i) {
+    if (async_thread_create(&pool->threads[i], async_pool_worker, pool) != 0)
+      break;
+    ++pool->nthreads;
+  }
+  if (pool->nthreads < nthreads) {
+    /* leave nothing running behind a pool the caller considers absent */
+    async_pool_destroy(pool);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Try to queue a blocking call
+ *
+ * A job that is refused again and again counts once in stats.rejected;
+ * clear job->rejected before reusing the record for another call.
+ *
+ * \return 1 if the call was queued, 0 if the queue is full
+ */
+static inline int async_pool_submit(struct async_pool *pool, struct async_blocking *job,
+                                    void *(*fn)(void *), void *arg)
+{
+  async_mutex_lock(&pool->lock);
+  if (pool->depth >= pool->max_depth) {
+    if (!job->rejected) {
+      job->rejected = 1;
+      ++pool->stats.rejected;
+    }
+    async_mutex_unlock(&pool->lock);
+    return 0;
+  }
+  job->fn = fn;
+  job->arg = arg;
+  job->result = NULL;
+  job->next = NULL;
+  job->state = ASYNC_BLOCKING_QUEUED;
+  job->queued_at = async_clock_ns();
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  if (++pool->depth > pool->stats.depth_max)
+    pool->stats.depth_max = pool->depth;
+  async_cond_signal(&pool->wake);
+  async_mutex_unlock(&pool->lock);
+  return 1;
+}
+
+/**
+ * Copy a pool's statistics
+ *
+ * \param pool (struct async_pool *) The pool to read
+ * \param out (struct async_pool_stats *) Receives a consistent snapshot
+ */
+static inline void async_pool_stats(struct async_pool *pool, struct async_pool_stats *out)
+{
+  async_mutex_lock(&pool->lock);
+  *out = pool->stats;
+  async_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Advance a blocking call: queue it if it isn't queued yet, then report
+ * whether it has returned
+ *
+ * \return 1 once the call has returned, 0 while it is still pending
+ */
+static inline int async_blocking_poll(struct async_pool *pool, struct async_blocking *job,
+                                      void *(*fn)(void *), void *arg)
+{
+  if (async_atomic_load(&job->state) == ASYNC_BLOCKING_IDLE)
+    async_pool_submit(pool, job, fn, arg);
+  return async_atomic_load(&job->state) == ASYNC_BLOCKING_DONE;
+}
+
+/**
+ * Run a blocking call on the pool and wait for it to return
+ *
+ * The subroutine first waits for room in the pool's queue, then waits
+ * for a worker to run the call. Latency of the individual call is left
+ * in job->queue_ns and job->run_ns.
+ *
+ * \param pool (struct async_pool *) The pool to run the call on
+ * \param job (struct async_blocking *) The job record, from the async state
+ * \param f (void *(*)(void *)) The blocking function
+ * \param a (void *) The argument passed to f
+ * \param res (lvalue) Receives the value returned by f
+ */
+#define await_blocking(pool, job, f, a, res)				\
+  do {									\
+    (job)->state = ASYNC_BLOCKING_IDLE;					\
+    (job)->rejected = 0;						\
+    await(async_blocking_poll(pool, job, f, a));			\
+    (res) = (job)->result;						\
+  } while(0)
+
+#endif /* ASYNC_BLOCKING_H */
@@ -0,0 +1,191 @@
+/**
+ * \file
+ * Cooperative time slices and detection of subroutines that run too long
+ * between awaits.
+ *
+ * An async subroutine keeps the driver loop to itself until it reaches an
+ * await or yield, so a long loop without one stalls every other subroutine.
+ * Two tools address this:
+ *
+ * - A budget lets a subroutine bound its own slice: it yields in the middle
+ *   of long work once it has run longer than its budget.
+ *
+ *       async_budget_reset(&st->budget);
+ *       for (st->i = 0; st->i < st->n; ++st->i) {
+ *         process(st->items[st->i]);
+ *         async_yield_if_over_budget(&st->budget);
+ *       }
+ *
+ * - A watchdog wraps the calls in the driver loop, times every resume with
+ *   the time-stamp counter, and reports resumes over a threshold together
+ *   with the subroutine's name and the line of the await it resumed from
+ *   and the line it parked at next, which brackets the slow code.
+ *
+ *       while (!async_watch(&wd, codelock_thread, &codelock_pt)) {
+ *         async_watch(&wd, input_thread, &input_pt);
+ *         ...
+ *       }
+ *
+ * Budgets and thresholds are in async_ticks(); multiply microseconds by
+ * async_ticks_per_us() to convert.
+ */
+
+#ifndef ASYNC_BUDGET_H
+#define ASYNC_BUDGET_H
+
+#include "async-clock.h"
+#include "async.h"
+
+#include <stdio.h>
+
+/**
+ * A time slice budget. Store one in the async state of the subroutine.
+ */
+struct async_budget {
+  unsigned long long start;
+  unsigned long long limit;
+};
+
+/**
+ * Initialize a budget
+ *
+ * \param b (struct async_budget *) The budget
+ * \param ticks The longest slice, in async_ticks()
+ */
+#define async_budget_init(b, ticks) ((b)->limit = (ticks), (b)->start = async_ticks())
+
+/**
+ * Start a new slice, e.g. right after resuming from an await
+ */
+#define async_budget_reset(b) ((b)->start = async_ticks())
+
+/**
+ * Check whether the current slice has used up its budget
+ */
+#define async_over_budget(b) (async_ticks() - (b)->start > (b)->limit)
+
+/**
+ * Yield if the current slice has used up its budget, and start a new
+ * slice when resumed
+ *
+ * Like every await, this cannot share a source line with another await.
+ */
+#define async_yield_if_over_budget(b)					\
+  do {									\
+    if (async_over_budget(b)) {						\
+      async_yield;							\
+      async_budget_reset(b);						\
+    }									\
+  } while(0)
+
+/**
+ * A resume being timed: the line it resumed from, when it started, and
+ * the subroutine's result. The watchdog below and the profiler in
+ * async-profile.h each embed one.
+ */
+struct async_resume {
+  unsigned long long t0;
+  unsigned k0;
+  async ret;
+};
+
+/**
+ * Resume an async subroutine and time it
+ *
+ * Records the resume in r, calls f(state), and then evaluates end, which
+ * reads r and must evaluate to r's result. The resume in progress lives
+ * in r, so use at most one timed resume per expression.
+ *
+ * \param r (struct async_resume *) Where the resume is recorded
+ * \param f The async subroutine
+ * \param state The subroutine's state
+ * \param end The expression that accounts for the resume
+ */
+#define async_resume_timed(r, f, state, end)				\
+  ((r)->k0 = (state)->_async_k, (r)->t0 = async_ticks(),		\
+   (r)->ret = (f)(state), (end))
+
+/**
+ * Reports a resume that ran over the watchdog's threshold
+ *
+ * \param name The subroutine's name
+ * \param from The line of the await it resumed from, or 0 if it started
+ * from the beginning
+ * \param to The line of the await it parked at, or 1 if it completed
+ * \param ticks How long the resume ran
+ */
+typedef void (*async_watchdog_fn)(void *ctx, const char *name, unsigned from, unsigned to,
+                                  unsigned long long ticks);
+
+/**
+ * Watches the resumes of a driver loop. Not thread-safe; use one per
+ * driver loop.
+ */
+struct async_watchdog {
+  unsigned long long threshold;
+  async_watchdog_fn report;
+  void *ctx;
+  unsigned long long resumes, overruns;
+  unsigned long long worst;         /* longest resume seen */
+  const char *worst_name;
+  unsigned worst_from, worst_to;
+  struct async_resume cur;          /* the resume in progress */
+};
+
+static inline void async_watchdog_print(void *ctx, const char *name, unsigned from, unsigned to,
+                                        unsigned long long ticks)
+{
+  fprintf(ctx ? (FILE *)ctx : stderr, "async: %s ran %llu ticks between lines %u and %u\n",
+          name, ticks, from, to);
+}
+
+/**
+ * Initialize a watchdog
+ *
+ * \param w (struct async_watchdog *) The watchdog
+ * \param ticks Resumes longer than this are reported
+ * \param fn Called for every overrun, or NULL to print to stderr
+ * \param c Passed to fn
+ */
+static inline void async_watchdog_init(struct async_watchdog *w, unsigned long long ticks,
+                                       async_watchdog_fn fn, void *c)
+{
+  w->threshold = ticks;
+  w->report = fn ? fn : async_watchdog_print;
+  w->ctx = c;
+  w->resumes = w->overruns = w->worst = 0;
+  w->worst_name = NULL;
+  w->worst_from = w->worst_to = 0;
+}
+
+static inline async async_watchdog_end(struct async_watchdog *w, const char *name, unsigned k)
+{
+  unsigned long long ticks = async_ticks() - w->cur.t0;
+  ++w->resumes;
+  if (ticks > w->worst) {
+    w->worst = ticks;
+    w->worst_name = name;
+    w->worst_from = w->cur.k0;
+    w->worst_to = k;
+  }
+  if (ticks > w->threshold) {
+    ++w->overruns;
+    w->report(w->ctx, name, w->cur.k0, k, ticks);
+  }
+  return w->cur.ret;
+}
+
+/**
+ * Resume an async subroutine under a watchdog
+ *
+ * Evaluates to the subroutine's result, like calling it directly; see
+ * async_resume_timed() for the one restriction.
+ *
+ * \param w (struct async_watchdog *) The watchdog
+ * \param f The async subroutine
+ * \param state The subroutine's state
+ */
+#define async_watch(w, f, state)					\
+  async_resume_timed(&(w)->cur, f, state, async_watchdog_end(w, #f, (state)->_async_k))
+
+#endif /* ASYNC_BUDGET_H */
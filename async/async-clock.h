@@ -0,0 +1,82 @@
+/**
+ * \file
+ * Clocks used by the optional async.h extensions for latency statistics.
+ * async.h itself does not need a clock.
+ *
+ * async_clock_ns() reads a monotonic clock in nanoseconds. async_ticks()
+ * reads the CPU's time-stamp counter where there is one, which is cheap
+ * enough to call around every resume; elsewhere it falls back to
+ * async_clock_ns().
+ */
+
+#ifndef ASYNC_CLOCK_H
+#define ASYNC_CLOCK_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define ASYNC_HAVE_TSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define ASYNC_HAVE_TSC 1
+#endif
+
+/**
+ * Read a monotonic clock
+ *
+ * \return Nanoseconds since an arbitrary, fixed starting point.
+ */
+static inline unsigned long long async_clock_ns(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&freq);
+  return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000000ULL
+       + (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Read the time-stamp counter
+ *
+ * \return Ticks since an arbitrary starting point; see async_ticks_per_us()
+ */
+static inline unsigned long long async_ticks(void)
+{
+#ifdef ASYNC_HAVE_TSC
+  return __rdtsc();
+#else
+  return async_clock_ns();
+#endif
+}
+
+/**
+ * Measure how many ticks elapse per microsecond
+ *
+ * Spins for about a millisecond the first time it is called.
+ */
+static inline unsigned long long async_ticks_per_us(void)
+{
+  static unsigned long long rate;
+  if (rate == 0) {
+    unsigned long long t0 = async_ticks(), ns0 = async_clock_ns(), ns;
+    while ((ns = async_clock_ns()) - ns0 < 1000000)
+      ;
+    rate = (async_ticks() - t0) * 1000 / (ns - ns0);
+    if (rate == 0)
+      rate = 1;
+  }
+  return rate;
+}
+
+#endif /* ASYNC_CLOCK_H */
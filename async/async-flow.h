@@ -0,0 +1,221 @@
+/**
+ * \file
+ * Flow control on async: token buckets, weighted concurrency limiters with
+ * FIFO admission, and an AIMD limiter that adapts to observed latency.
+ *
+ * Like the semaphores in async-sem.h these are meant to be shared by the
+ * async subroutines of one driver loop and are not thread-safe. None of
+ * them reads a clock: times are passed in by the caller in whatever unit
+ * the caller's clock uses (nanoseconds for async_clock_ns() from
+ * async-clock.h), and because await() re-evaluates its arguments on every
+ * resume, passing the clock call itself works as expected:
+ *
+ *     await_bucket(&bucket, 1, async_clock_ns());
+ */
+
+#ifndef ASYNC_FLOW_H
+#define ASYNC_FLOW_H
+
+#include "async.h"
+
+/**
+ * A token bucket that refills at a fixed rate up to a maximum burst.
+ *
+ * Tokens are kept in units of 1/ASYNC_BUCKET_SCALE of a token so that
+ * fractional refills are never lost to rounding.
+ */
+struct async_bucket {
+  unsigned long long rate;    /* tokens per ASYNC_BUCKET_SCALE time units */
+  unsigned long long burst;   /* capacity, in scaled units */
+  unsigned long long tokens;  /* available, in scaled units */
+  unsigned long long last;    /* time of the last refill */
+};
+
+/* Time units per second when times come from async_clock_ns() */
+#ifndef ASYNC_BUCKET_SCALE
+#define ASYNC_BUCKET_SCALE 1000000000ULL
+#endif
+
+/**
+ * Initialize a token bucket
+ *
+ * The bucket starts full.
+ *
+ * \param b (struct async_bucket *) The bucket
+ * \param r Tokens added per second (per ASYNC_BUCKET_SCALE time units)
+ * \param n Maximum number of tokens the bucket can hold
+ * \param now The current time
+ */
+#define init_bucket(b, r, n, now)					\
+  do {									\
+    (b)->rate = (r);							\
+    (b)->burst = (unsigned long long)(n) * ASYNC_BUCKET_SCALE;		\
+    (b)->tokens = (b)->burst;						\
+    (b)->last = (now);							\
+  } while(0)
+
+/**
+ * Refill a bucket and take n tokens if they are available
+ *
+ * \return 1 if the tokens were taken, 0 otherwise
+ */
+static inline int async_bucket_take(struct async_bucket *b, unsigned n, unsigned long long now)
+{
+  unsigned long long want = (unsigned long long)n * ASYNC_BUCKET_SCALE;
+  if (now > b->last) {
+    unsigned long long room = b->burst - b->tokens;
+    unsigned long long elapsed = now - b->last;
+    /* clamp before multiplying so long idle periods can't overflow */
+    if (b->rate != 0 && elapsed >= room / b->rate)
+      b->tokens = b->burst;
+    else
+      b->tokens += elapsed * b->rate;
+    b->last = now;
+  }
+  if (b->tokens < want)
+    return 0;
+  b->tokens -= want;
+  return 1;
+}
+
+/**
+ * Wait until n tokens are available and take them
+ *
+ * \param b (struct async_bucket *) The bucket
+ * \param n The number of tokens, at most the bucket's burst
+ * \param now An expression yielding the current time
+ */
+#define await_bucket(b, n, now) await(async_bucket_take(b, n, now))
+
+/**
+ * A weighted concurrency limiter with first-come, first-served admission.
+ *
+ * Each waiter draws a ticket and is admitted strictly in ticket order, so a
+ * heavy request at the head of the line is not overtaken by a stream of
+ * light ones, and checking whether it is a waiter's turn costs O(1) no
+ * matter how many are waiting.
+ */
+struct async_limiter {
+  unsigned limit;
+  unsigned in_use;
+  unsigned next_ticket;
+  unsigned serving;
+};
+
+/**
+ * Initialize a concurrency limiter
+ *
+ * \param l (struct async_limiter *) The limiter
+ * \param c The total weight that may be admitted at once
+ */
+#define init_limiter(l, c)						\
+  do {									\
+    (l)->limit = (c);							\
+    (l)->in_use = (l)->next_ticket = (l)->serving = 0;			\
+  } while(0)
+
+/**
+ * Admit the holder of a ticket if it is at the head of the line and its
+ * weight fits. A weight larger than the whole limit is admitted alone.
+ */
+static inline int async_limiter_admit(struct async_limiter *l, unsigned ticket, unsigned w)
+{
+  if (l->serving != ticket || (l->in_use != 0 && l->in_use + w > l->limit))
+    return 0;
+  l->in_use += w;
+  ++l->serving;
+  return 1;
+}
+
+/**
+ * Wait for admission to a concurrency limiter
+ *
+ * A subroutine that has drawn a ticket must not be abandoned before it is
+ * admitted, or every later waiter stalls behind it.
+ *
+ * \param l (struct async_limiter *) The limiter
+ * \param w (unsigned) The weight of this request
+ * \param ticket (unsigned lvalue) Storage for the waiter's ticket; must be
+ * part of the async state
+ */
+#define await_limiter(l, w, ticket)					\
+  do {									\
+    (ticket) = (l)->next_ticket++;					\
+    await(async_limiter_admit(l, ticket, w));				\
+  } while(0)
+
+/**
+ * Release weight admitted by await_limiter()
+ */
+#define signal_limiter(l, w) ((l)->in_use -= (w))
+
+/**
+ * A concurrency limiter whose limit adapts to latency: additive increase
+ * while requests complete within the target latency, multiplicative
+ * decrease when they don't.
+ */
+struct async_aimd {
+  struct async_limiter lim;
+  unsigned min, max;
+  unsigned long long target;
+  unsigned successes;         /* completions since the last increase */
+};
+
+/**
+ * Initialize an adaptive limiter
+ *
+ * \param a (struct async_aimd *) The limiter
+ * \param lo The smallest limit, at least 1
+ * \param hi The largest limit
+ * \param t The latency above which the limit is reduced
+ */
+#define init_aimd(a, lo, hi, t)						\
+  do {									\
+    init_limiter(&(a)->lim, lo);					\
+    (a)->min = (lo);							\
+    (a)->max = (hi);							\
+    (a)->target = (t);							\
+    (a)->successes = 0;							\
+  } while(0)
+
+/**
+ * Release weight admitted by await_aimd() and feed back its latency
+ *
+ * The limit grows by one after a full limit's worth of on-time
+ * completions, which is roughly once per round trip, and shrinks to 90%
+ * on every late one.
+ */
+static inline void async_aimd_release(struct async_aimd *a, unsigned w, unsigned long long latency)
+{
+  struct async_limiter *l = &a->lim;
+  l->in_use -= w;
+  if (latency > a->target) {
+    l->limit = l->limit * 9 / 10;
+    if (l->limit < a->min)
+      l->limit = a->min;
+    a->successes = 0;
+  } else if (++a->successes >= l->limit) {
+    if (l->limit < a->max)
+      ++l->limit;
+    a->successes = 0;
+  }
+}
+
+/**
+ * Wait for admission to an adaptive limiter
+ *
+ * \param a (struct async_aimd *) The limiter
+ * \param w (unsigned) The weight of this request
+ * \param ticket (unsigned lvalue) Storage for the waiter's ticket; must be
+ * part of the async state
+ */
+#define await_aimd(a, w, ticket) await_limiter(&(a)->lim, w, ticket)
+
+/**
+ * Release weight admitted by await_aimd()
+ *
+ * \param latency How long the request took, in the same unit as the target
+ */
+#define signal_aimd(a, w, latency) async_aimd_release(a, w, latency)
+
+#endif /* ASYNC_FLOW_H */
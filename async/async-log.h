@@ -0,0 +1,359 @@
+/**
+ * \file
+ * Non-blocking logging for async subroutines.
+ *
+ * printf() from inside an async subroutine formats the message, takes the
+ * stream lock and may block in write(), all while every other subroutine on
+ * the driver loop waits. async_log() instead copies the format pointer and
+ * the raw arguments into a fixed-size record in a lock-free ring and
+ * returns; formatting and writing happen later, in async_log_drain(),
+ * called either from an idle point of the driver loop or from a dedicated
+ * sink thread.
+ *
+ *     static struct async_log log;
+ *     ...
+ *     async_log(&log, "Item %d consumed\n", item);
+ *     ...
+ *     while (!driver(&pt)) {
+ *       async_log_drain(&log, stdout);
+ *       ...
+ *     }
+ *
+ * Each ring has a single producer and a single consumer, so use one ring
+ * per thread that logs. When a ring is full, records are dropped and
+ * counted rather than blocking the producer.
+ *
+ * Because formatting is deferred:
+ *
+ * 1. The format must be a string literal, or otherwise outlive the record.
+ * 2. %s arguments are stored as pointers and must outlive the record too.
+ * 3. At most ASYNC_LOG_ARGS arguments are stored, counting '*' widths and
+ *    precisions; conversions past that are written out unformatted.
+ * 4. %n stores nothing; its pointer is skipped.
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "async-thread.h"
+
+/* Must be a power of two */
+#ifndef ASYNC_LOG_SIZE
+#define ASYNC_LOG_SIZE 1024
+#endif
+
+#ifndef ASYNC_LOG_ARGS
+#define ASYNC_LOG_ARGS 6
+#endif
+
+#ifndef ASYNC_CACHE_LINE
+#define ASYNC_CACHE_LINE 64
+#endif
+
+union async_log_arg {
+  long long i;
+  double d;
+  const void *p;
+};
+
+/**
+ * One log record: the unformatted message
+ */
+struct async_log_rec {
+  const char *fmt;
+  union async_log_arg arg[ASYNC_LOG_ARGS];
+};
+
+struct async_log {
+  unsigned head;              /* written by the consumer */
+  char pad0[ASYNC_CACHE_LINE - sizeof(unsigned)];
+  unsigned tail;              /* written by the producer */
+  unsigned dropped;           /* records lost to a full ring */
+  char pad1[ASYNC_CACHE_LINE - 2 * sizeof(unsigned)];
+  struct async_log_rec rec[ASYNC_LOG_SIZE];
+};
+
+/* the kinds after ASYNC_LOG_COUNT store an argument */
+enum { ASYNC_LOG_END, ASYNC_LOG_NONE, ASYNC_LOG_COUNT, ASYNC_LOG_SIGNED, ASYNC_LOG_UNSIGNED, ASYNC_LOG_CHAR,
+       ASYNC_LOG_DOUBLE, ASYNC_LOG_STRING, ASYNC_LOG_POINTER };
+
+/**
+ * Find the next conversion in a format string
+ *
+ * \param fmt (const char **) Advanced past the conversion
+ * \param len (char *) Receives the length modifier: 0, 'H' (hh), 'h',
+ * 'l', 'L' (ll), 'j', 'z', 't' or 'D' (long double)
+ * \param stars (unsigned *) Receives the number of '*' widths and
+ * precisions, each of which takes an int argument first
+ * \param start (const char **) Receives the start of the conversion
+ * \return The kind of argument the conversion consumes
+ */
+static inline int async_log_next(const char **fmt, char *len, unsigned *stars, const char **start)
+{
+  const char *f = *fmt;
+  for (;;) {
+    while (*f && *f != '%')
+      ++f;
+    if (!*f) {
+      *fmt = f;
+      return ASYNC_LOG_END;
+    }
+    *start = f++;
+    *stars = 0;
+    while (*f && strchr("-+ #0123456789.*", *f))
+      *stars += *f++ == '*';
+    *len = 0;
+    if (f[0] == 'h' && f[1] == 'h') { *len = 'H'; f += 2; }
+    else if (f[0] == 'l' && f[1] == 'l') { *len = 'L'; f += 2; }
+    else if (*f == 'L') { *len = 'D'; ++f; }
+    else if (*f && strchr("hljzt", *f)) *len = *f++;
+    *fmt = *f ? f + 1 : f;
+    switch (*f) {
+    case 'd': case 'i': return ASYNC_LOG_SIGNED;
+    case 'o': case 'u': case 'x': case 'X': return ASYNC_LOG_UNSIGNED;
+    case 'c': return ASYNC_LOG_CHAR;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': return ASYNC_LOG_DOUBLE;
+    case 's': return ASYNC_LOG_STRING;
+    case 'p': return ASYNC_LOG_POINTER;
+    case 'n': return ASYNC_LOG_COUNT;
+    default: return ASYNC_LOG_NONE; /* %% or malformed */
+    }
+  }
+}
+
+/**
+ * Append a record to a log ring without formatting it
+ *
+ * Only the producer thread of the ring may call this.
+ *
+ * \return 1 if the record was stored, 0 if the ring was full and the
+ * record was dropped
+ */
+static inline int async_log(struct async_log *l, const char *fmt, ...)
+{
+  unsigned tail = l->tail, n = 0, stars;
+  struct async_log_rec *r;
+  const char *f = fmt, *start;
+  char len;
+  int kind;
+  va_list ap;
+
+  if (tail - async_atomic_load(&l->head) == ASYNC_LOG_SIZE) {
+    async_atomic_store(&l->dropped, l->dropped + 1);
+    return 0;
+  }
+  r = &l->rec[tail & (ASYNC_LOG_SIZE - 1)];
+  r->fmt = fmt;
+  va_start(ap, fmt);
+  while ((kind = async_log_next(&f, &len, &stars, &start)) != ASYNC_LOG_END) {
+    union async_log_arg *a;
+    /* stop at the first conversion whose arguments don't all fit */
+    if (n + stars + (kind > ASYNC_LOG_COUNT) > ASYNC_LOG_ARGS)
+      break;
+    for (; stars > 0; --stars)
+      r->arg[n++].i = va_arg(ap, int);
+    a = &r->arg[n];
+    switch (kind) {
+    case ASYNC_LOG_SIGNED:
+      a->i = len == 'l' ? va_arg(ap, long) : len == 'L' ? va_arg(ap, long long) :
+             len == 'j' ? (long long)va_arg(ap, intmax_t) : len == 'z' ? (long long)va_arg(ap, size_t) :
+             len == 't' ? (long long)va_arg(ap, ptrdiff_t) : va_arg(ap, int);
+      if (len == 'H') a->i = (signed char)a->i;
+      else if (len == 'h') a->i = (short)a->i;
+      break;
+    case ASYNC_LOG_UNSIGNED:
+      a->i = (long long)(len == 'l' ? va_arg(ap, unsigned long) : len == 'L' ? va_arg(ap, unsigned long long) :
+             len == 'j' ? (unsigned long long)va_arg(ap, uintmax_t) : len == 'z' ? va_arg(ap, size_t) :
+             len == 't' ? (unsigned long long)va_arg(ap, ptrdiff_t) : va_arg(ap, unsigned));
+      if (len == 'H') a->i = (unsigned char)a->i;
+      else if (len == 'h') a->i = (unsigned short)a->i;
+      break;
+    case ASYNC_LOG_CHAR:
+      a->i = va_arg(ap, int);
+      break;
+    case ASYNC_LOG_DOUBLE:
+      a->d = len == 'D' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+      break;
+    case ASYNC_LOG_STRING:
+    case ASYNC_LOG_POINTER:
+      a->p = va_arg(ap, const void *);
+      break;
+    case ASYNC_LOG_COUNT:
+      (void)va_arg(ap, void *);
+      continue;
+    default:
+      continue;
+    }
+    ++n;
+  }
+  va_end(ap);
+  async_atomic_store(&l->tail, tail + 1);
+  return 1;
+}
+
+/**
+ * Format one record
+ */
+static inline void async_log_format(const struct async_log_rec *r, FILE *out)
+{
+  const char *f = r->fmt, *lit = f, *start;
+  char spec[64], len;
+  unsigned n = 0, stars, full = 0;
+  int kind;
+
+  while ((kind = async_log_next(&f, &len, &stars, &start)) != ASYNC_LOG_END) {
+    size_t body, i, m;
+    fwrite(lit, 1, (size_t)(start - lit), out);
+    lit = f;
+    if (full || n + stars + (kind > ASYNC_LOG_COUNT) > ASYNC_LOG_ARGS) {
+      /* async_log() stored nothing from here on */
+      full = 1;
+      fwrite(start, 1, (size_t)(f - start), out);
+      continue;
+    }
+    /* rebuild the conversion with the stored argument's own type, and with
+     * the stored values in place of '*' */
+    body = (size_t)(f - start - 1);
+    while (body > 1 && strchr("hljztL", start[body - 1]))
+      --body;
+    if (body + stars * 11 + 4 > sizeof(spec)) {
+      fwrite(start, 1, (size_t)(f - start), out);
+      n += stars + (kind > ASYNC_LOG_COUNT);
+      continue;
+    }
+    for (i = 0, m = 0; i < body; ++i) {
+      int v;
+      if (start[i] != '*') {
+        spec[m++] = start[i];
+        continue;
+      }
+      v = (int)r->arg[n++].i;
+      if (m > 0 && spec[m - 1] == '.' && v < 0)
+        --m; /* a negative precision means none */
+      else
+        m += (size_t)sprintf(spec + m, "%d", v);
+    }
+    if (kind == ASYNC_LOG_SIGNED || kind == ASYNC_LOG_UNSIGNED)
+      spec[m++] = 'l', spec[m++] = 'l';
+    else if (len == 'l' && (kind == ASYNC_LOG_CHAR || kind == ASYNC_LOG_STRING))
+      spec[m++] = 'l'; /* %lc and %ls take wide characters */
+    spec[m++] = f[-1];
+    spec[m] = 0;
+    switch (kind) {
+    case ASYNC_LOG_SIGNED: fprintf(out, spec, r->arg[n++].i); break;
+    case ASYNC_LOG_UNSIGNED: fprintf(out, spec, (unsigned long long)r->arg[n++].i); break;
+    case ASYNC_LOG_CHAR:
+      if (len == 'l')
+        fprintf(out, spec, (wint_t)r->arg[n++].i);
+      else
+        fprintf(out, spec, (int)r->arg[n++].i);
+      break;
+    case ASYNC_LOG_DOUBLE: fprintf(out, spec, r->arg[n++].d); break;
+    case ASYNC_LOG_STRING:
+      if (len == 'l')
+        fprintf(out, spec, (const wchar_t *)r->arg[n++].p);
+      else
+        fprintf(out, spec, (const char *)r->arg[n++].p);
+      break;
+    case ASYNC_LOG_POINTER: fprintf(out, spec, r->arg[n++].p); break;
+    case ASYNC_LOG_COUNT: break;
+    default: if (f[-1] == '%') fputc('%', out); break;
+    }
+  }
+  fputs(lit, out);
+}
+
+/**
+ * Format and write every record in a ring
+ *
+ * Only the consumer of the ring may call this.
+ *
+ * \return The number of records written
+ */
+static inline unsigned async_log_drain(struct async_log *l, FILE *out)
+{
+  unsigned head = l->head, tail = async_atomic_load(&l->tail), n = 0;
+  for (; head != tail; ++head, ++n) {
+    async_log_format(&l->rec[head & (ASYNC_LOG_SIZE - 1)], out);
+    /* free each slot as soon as it is formatted */
+    async_atomic_store(&l->head, head + 1);
+  }
+  return n;
+}
+
+/**
+ * Initialize an empty log ring
+ */
+#define async_log_init(l) ((l)->head = (l)->tail = (l)->dropped = 0)
+
+/**
+ * A thread that drains a set of log rings into a stream.
+ */
+struct async_log_sink {
+  struct async_log **logs;
+  unsigned n;
+  FILE *out;
+  unsigned stop;
+  async_thread thread;
+};
+
+static inline async_thread_fn(async_log_sink_main, arg)
+{
+  struct async_log_sink *s = (struct async_log_sink *)arg;
+  unsigned i, wrote;
+  for (;;) {
+    int stopping = async_atomic_load(&s->stop) != 0;
+    for (i = 0, wrote = 0; i < s->n; ++i)
+      wrote += async_log_drain(s->logs[i], s->out);
+    if (wrote) {
+      fflush(s->out);
+    } else if (stopping) {
+      break;
+    } else {
+#ifdef _WIN32
+      Sleep(1);
+#else
+      struct timespec ts = { 0, 1000000 };
+      nanosleep(&ts, NULL);
+#endif
+    }
+  }
+  async_thread_return;
+}
+
+/**
+ * Start a thread draining the given rings
+ *
+ * \param s (struct async_log_sink *) The sink
+ * \param logs (struct async_log **) The rings; the sink becomes their
+ * only consumer
+ * \param n The number of rings
+ * \param out (FILE *) Where formatted records are written
+ * \return 0 on success, -1 if the thread could not be started
+ */
+static inline int async_log_sink_start(struct async_log_sink *s, struct async_log **logs, unsigned n, FILE *out)
+{
+  s->logs = logs;
+  s->n = n;
+  s->out = out;
+  s->stop = 0;
+  return async_thread_create(&s->thread, async_log_sink_main, s);
+}
+
+/**
+ * Drain whatever is left in the rings and stop the sink thread
+ */
+static inline void async_log_sink_stop(struct async_log_sink *s)
+{
+  async_atomic_store(&s->stop, 1);
+  async_thread_join(s->thread);
+}
+
+#endif /* ASYNC_LOG_H */
@@ -0,0 +1,181 @@
+/**
+ * \file
+ * Parallel loops and map/reduce over index ranges, run as chunks on the
+ * worker pool from async-blocking.h.
+ *
+ * The range [0, n) is split into chunks, each chunk is handed to a worker,
+ * and the calling async subroutine waits until all of them are finished:
+ *
+ *     static void sum_chunk(void *ctx, unsigned c, size_t begin, size_t end) {
+ *       struct sum *s = ctx;
+ *       for (s->partial[c] = 0; begin < end; ++begin)
+ *         s->partial[c] += s->data[begin];
+ *     }
+ *     static void sum_reduce(void *ctx, unsigned nchunks) {
+ *       struct sum *s = ctx;
+ *       for (s->total = 0; nchunks--; )
+ *         s->total += s->partial[nchunks];
+ *     }
+ *     ...
+ *     await_map_reduce(&pool, &st->pf, n, 4096, sum_chunk, sum_reduce, &st->sum);
+ *
+ * Each chunk receives its index, so partial results go into a per-chunk
+ * slot without any locking; reduce then runs once, on the caller's thread,
+ * after every chunk has finished. The partial array needs room for
+ * ASYNC_PFOR_MAX_CHUNKS entries. An empty range has no chunks: body never
+ * runs and reduce still runs, with nchunks == 0.
+ *
+ * Chunk sizes adapt to the input and to the pool's load:
+ *
+ * - a range of at most `grain` items runs inline on the calling thread, so
+ *   small inputs never pay for a hand-off;
+ * - otherwise the range is split into up to 4 chunks per worker so uneven
+ *   chunks balance out, but only 1 per worker if the pool already has a
+ *   backlog, since the other work will keep the workers busy anyway;
+ * - no chunk is ever smaller than `grain`.
+ */
+
+#ifndef ASYNC_PARALLEL_H
+#define ASYNC_PARALLEL_H
+
+#include "async-blocking.h"
+
+#ifndef ASYNC_PFOR_MAX_CHUNKS
+#define ASYNC_PFOR_MAX_CHUNKS 64
+#endif
+
+struct async_pfor;
+
+struct async_pfor_chunk {
+  struct async_blocking job;
+  struct async_pfor *pf;
+  unsigned index;
+  size_t begin, end;
+};
+
+/**
+ * The state of one parallel loop. Store it in the async state of the
+ * subroutine awaiting the loop.
+ */
+struct async_pfor {
+  void (*body)(void *ctx, unsigned chunk, size_t begin, size_t end);
+  void (*reduce)(void *ctx, unsigned nchunks);
+  void *ctx;
+  unsigned nchunks;
+  unsigned submitted;
+  struct async_pfor_chunk chunk[ASYNC_PFOR_MAX_CHUNKS];
+};
+
+static inline void *async_pfor_run(void *arg)
+{
+  struct async_pfor_chunk *c = (struct async_pfor_chunk *)arg;
+  c->pf->body(c->pf->ctx, c->index, c->begin, c->end);
+  return NULL;
+}
+
+/**
+ * Split a range into chunks, running it inline if it is too small to be
+ * worth distributing
+ */
+static inline void async_pfor_init(struct async_pool *pool, struct async_pfor *pf, size_t n, size_t grain,
+                                   void (*body)(void *, unsigned, size_t, size_t),
+                                   void (*reduce)(void *, unsigned), void *ctx)
+{
+  size_t chunks, i, per, extra, begin;
+  unsigned backlog;
+
+  pf->body = body;
+  pf->reduce = reduce;
+  pf->ctx = ctx;
+  pf->submitted = 0;
+  if (grain == 0)
+    grain = 1;
+  if (n == 0) {
+    pf->nchunks = 0;
+    return;
+  }
+  if (n <= grain) {
+    pf->nchunks = 1;
+    pf->submitted = 1;
+    body(ctx, 0, 0, n);
+    pf->chunk[0].job.state = ASYNC_BLOCKING_DONE;
+    return;
+  }
+
+  async_mutex_lock(&pool->lock);
+  backlog = pool->depth;
+  async_mutex_unlock(&pool->lock);
+
+  chunks = pool->nthreads * (backlog >= pool->nthreads ? 1 : 4);
+  if (chunks > n / grain)
+    chunks = n / grain;
+  if (chunks > ASYNC_PFOR_MAX_CHUNKS)
+    chunks = ASYNC_PFOR_MAX_CHUNKS;
+  if (chunks == 0)
+    chunks = 1;
+
+  /* spread the remainder so chunk sizes differ by at most one */
+  per = n / chunks;
+  extra = n % chunks;
+  for (i = 0, begin = 0; i < chunks; ++i) {
+    struct async_pfor_chunk *c = &pf->chunk[i];
+    c->job.state = ASYNC_BLOCKING_IDLE;
+    c->job.rejected = 0;
+    c->pf = pf;
+    c->index = (unsigned)i;
+    c->begin = begin;
+    begin += per + (i < extra);
+    c->end = begin;
+  }
+  pf->nchunks = (unsigned)chunks;
+}
+
+/**
+ * Submit as many remaining chunks as the pool will take, and run the
+ * reduction once every chunk has finished
+ *
+ * \return 1 once the loop is complete, 0 while chunks are outstanding
+ */
+static inline int async_pfor_poll(struct async_pool *pool, struct async_pfor *pf)
+{
+  unsigned i;
+  while (pf->submitted < pf->nchunks &&
+         async_pool_submit(pool, &pf->chunk[pf->submitted].job, async_pfor_run, &pf->chunk[pf->submitted]))
+    ++pf->submitted;
+  /* a chunk is finished only once its worker has stopped touching the job */
+  for (i = 0; i < pf->nchunks; ++i)
+    if (async_atomic_load(&pf->chunk[i].job.state) != ASYNC_BLOCKING_DONE)
+      return 0;
+  if (pf->reduce)
+    pf->reduce(pf->ctx, pf->nchunks);
+  return 1;
+}
+
+/**
+ * Run body over [0, n) in parallel and wait for it to finish
+ *
+ * \param pool (struct async_pool *) The pool the chunks run on
+ * \param pf (struct async_pfor *) The loop state, from the async state
+ * \param n (size_t) The number of items
+ * \param grain (size_t) The smallest number of items worth running as
+ * a separate chunk
+ * \param body Called as body(ctx, chunk, begin, end) for every chunk
+ * \param ctx (void *) Passed through to body
+ */
+#define await_parallel_for(pool, pf, n, grain, body, ctx)		\
+  await_map_reduce(pool, pf, n, grain, body, NULL, ctx)
+
+/**
+ * Map over [0, n) in parallel, reduce the per-chunk results and wait for
+ * the result
+ *
+ * \param reduce Called as reduce(ctx, nchunks) on the calling thread once
+ * all chunks have finished; nchunks is 0 when n is 0
+ */
+#define await_map_reduce(pool, pf, n, grain, map, reduce, ctx)		\
+  do {									\
+    async_pfor_init(pool, pf, n, grain, map, reduce, ctx);		\
+    await(async_pfor_poll(pool, pf));					\
+  } while(0)
+
+#endif /* ASYNC_PARALLEL_H */
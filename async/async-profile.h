@@ -0,0 +1,254 @@
+/**
+ * \file
+ * A profiler that attributes waiting and running time to individual await
+ * sites, identified by subroutine name and the line stored in _async_k.
+ *
+ * Wrap the calls in the driver loop with async_profile(), giving each
+ * profiled subroutine a probe in its state:
+ *
+ *     while (!async_profile(&prof, &codelock_probe, codelock_thread, &codelock_pt)) {
+ *       async_profile(&prof, &input_probe, input_thread, &input_pt);
+ *       ...
+ *     }
+ *     async_profile_report(&prof, stdout);
+ *
+ * For every await site the profiler records:
+ *
+ * - how long subroutines waited there, from parking at the site to the
+ *   resume that got past it;
+ * - how often a resume found the condition still false and parked at the
+ *   same site again without progress (a wasted poll);
+ * - how long each resume from the site ran before parking again, in
+ *   wall-clock ticks, so time the thread spent preempted counts too.
+ *
+ * Waits and resume times go into log-linear histograms in the style of
+ * HdrHistogram, which can be written out in its .hgrm text format.
+ *
+ * A loop whose body makes progress and then parks at the same await again
+ * is indistinguishable from a failed poll; such sites over-report polls.
+ */
+
+#ifndef ASYNC_PROFILE_H
+#define ASYNC_PROFILE_H
+
+#include "async-budget.h"
+#include "async-clock.h"
+#include "async.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef ASYNC_PROFILE_SITES
+#define ASYNC_PROFILE_SITES 64
+#endif
+
+/* Each power of two is split into 2^ASYNC_HIST_SUB_BITS buckets */
+#ifndef ASYNC_HIST_SUB_BITS
+#define ASYNC_HIST_SUB_BITS 3
+#endif
+
+/* Values of 2^ASYNC_HIST_MAX_BITS and above share the last bucket */
+#ifndef ASYNC_HIST_MAX_BITS
+#define ASYNC_HIST_MAX_BITS 40
+#endif
+
+#define ASYNC_HIST_BUCKETS ((ASYNC_HIST_MAX_BITS - ASYNC_HIST_SUB_BITS + 1) << ASYNC_HIST_SUB_BITS)
+
+/**
+ * A log-linear histogram with a relative error of at most
+ * 1/2^ASYNC_HIST_SUB_BITS.
+ */
+struct async_hist {
+  unsigned long long count, sum, max;
+  unsigned bucket[ASYNC_HIST_BUCKETS];
+};
+
+static inline unsigned async_hist_index(unsigned long long v)
+{
+  unsigned p = 0;
+  unsigned long long x = v;
+  if (v < (1ULL << ASYNC_HIST_SUB_BITS))
+    return (unsigned)v;
+  while (x >>= 1)
+    ++p;
+  if (p >= ASYNC_HIST_MAX_BITS)
+    return ASYNC_HIST_BUCKETS - 1;
+  return ((p - ASYNC_HIST_SUB_BITS + 1) << ASYNC_HIST_SUB_BITS)
+       + (unsigned)((v >> (p - ASYNC_HIST_SUB_BITS)) & ((1u << ASYNC_HIST_SUB_BITS) - 1));
+}
+
+/**
+ * The smallest value that falls into a bucket
+ */
+static inline unsigned long long async_hist_value(unsigned i)
+{
+  unsigned e = i >> ASYNC_HIST_SUB_BITS;
+  unsigned long long m = i & ((1u << ASYNC_HIST_SUB_BITS) - 1);
+  if (e == 0)
+    return m;
+  return (m + (1ULL << ASYNC_HIST_SUB_BITS)) << (e - 1);
+}
+
+static inline void async_hist_add(struct async_hist *h, unsigned long long v)
+{
+  ++h->count;
+  h->sum += v;
+  if (v > h->max)
+    h->max = v;
+  ++h->bucket[async_hist_index(v)];
+}
+
+/**
+ * Estimate a percentile
+ *
+ * \param q The percentile, between 0 and 100
+ * \return The lower bound of the bucket holding the percentile
+ */
+static inline unsigned long long async_hist_percentile(const struct async_hist *h, double q)
+{
+  unsigned long long seen = 0, want = (unsigned long long)(q / 100.0 * (double)h->count + 0.5);
+  unsigned i;
+  if (want == 0)
+    want = 1;
+  for (i = 0; i < ASYNC_HIST_BUCKETS; ++i) {
+    seen += h->bucket[i];
+    if (seen >= want)
+      return async_hist_value(i);
+  }
+  return h->max;
+}
+
+/**
+ * Write a histogram as an HdrHistogram percentile distribution (.hgrm)
+ *
+ * \param scale Values are divided by this before printing, e.g.
+ * async_ticks_per_us() to print microseconds
+ */
+static inline void async_hist_write_hgrm(const struct async_hist *h, FILE *out, double scale)
+{
+  unsigned long long seen = 0;
+  unsigned i;
+  fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+  for (i = 0; i < ASYNC_HIST_BUCKETS; ++i) {
+    double pct;
+    if (h->bucket[i] == 0)
+      continue;
+    seen += h->bucket[i];
+    pct = (double)seen / (double)h->count;
+    if (seen < h->count)
+      fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", async_hist_value(i) / scale, pct, seen, 1.0 / (1.0 - pct));
+    else
+      fprintf(out, "%12.3f %14.12f %10llu\n", async_hist_value(i) / scale, pct, seen);
+  }
+  fprintf(out, "#[Mean    = %12.3f, Max = %12.3f]\n#[Total count = %12llu]\n",
+          h->count ? (double)h->sum / (double)h->count / scale : 0.0, h->max / scale, h->count);
+}
+
+/**
+ * The statistics of one await site. Line 0 stands for the start of the
+ * subroutine.
+ */
+struct async_site {
+  const char *name;
+  unsigned line;
+  unsigned long long waits;   /* waits that ended here */
+  unsigned long long polls;   /* resumes that made no progress */
+  struct async_hist wait;     /* ticks from parking to getting past the site */
+  struct async_hist run;      /* wall-clock ticks per resume from the site */
+};
+
+struct async_profile {
+  unsigned nsites;
+  unsigned long long dropped; /* resumes at sites that didn't fit in the table */
+  struct async_site site[ASYNC_PROFILE_SITES];
+  struct async_resume cur;    /* the resume in progress */
+};
+
+/**
+ * Per-subroutine profiler state. Keep one next to each profiled state.
+ */
+struct async_probe {
+  unsigned long long parked_at;
+};
+
+#define async_profile_init(p) memset(p, 0, sizeof(*(p)))
+
+static inline struct async_site *async_profile_site(struct async_profile *p, const char *name, unsigned line)
+{
+  unsigned h = (unsigned)(((size_t)name >> 3) * 31 + line) % ASYNC_PROFILE_SITES, i;
+  for (i = 0; i < ASYNC_PROFILE_SITES; ++i) {
+    struct async_site *s = &p->site[(h + i) % ASYNC_PROFILE_SITES];
+    if (s->name == name && s->line == line)
+      return s;
+    if (!s->name) {
+      s->name = name;
+      s->line = line;
+      ++p->nsites;
+      return s;
+    }
+  }
+  ++p->dropped;
+  return NULL;
+}
+
+static inline async async_profile_end(struct async_profile *p, struct async_probe *probe,
+                                      const char *name, unsigned k)
+{
+  const struct async_resume *r = &p->cur;
+  unsigned long long t1 = async_ticks();
+  struct async_site *s;
+  /* calling a finished subroutine again does nothing; don't count it */
+  if (r->k0 == ASYNC_DONE)
+    return r->ret;
+  s = async_profile_site(p, name, r->k0);
+  if (s) {
+    async_hist_add(&s->run, t1 - r->t0);
+    if (k == r->k0) {
+      ++s->polls;
+    } else if (r->k0 != ASYNC_INIT) {
+      ++s->waits;
+      async_hist_add(&s->wait, r->t0 - probe->parked_at);
+    }
+  }
+  if (k != r->k0)
+    probe->parked_at = t1;
+  return r->ret;
+}
+
+/**
+ * Resume an async subroutine under the profiler
+ *
+ * Evaluates to the subroutine's result, like calling it directly; see
+ * async_resume_timed() for the one restriction.
+ *
+ * \param p (struct async_profile *) The profiler
+ * \param probe (struct async_probe *) The subroutine's probe
+ * \param f The async subroutine
+ * \param state The subroutine's state
+ */
+#define async_profile(p, probe, f, state)				\
+  async_resume_timed(&(p)->cur, f, state, async_profile_end(p, probe, #f, (state)->_async_k))
+
+/**
+ * Print one line per await site with wait, poll and resume statistics,
+ * with times in microseconds
+ */
+static inline void async_profile_report(const struct async_profile *p, FILE *out)
+{
+  double us = (double)async_ticks_per_us();
+  unsigned i;
+  fprintf(out, "%-24s %6s %10s %10s %10s %10s %10s %10s %10s\n", "subroutine", "line", "waits", "polls",
+          "wait p50", "wait p99", "wait max", "run p99", "run max");
+  for (i = 0; i < ASYNC_PROFILE_SITES; ++i) {
+    const struct async_site *s = &p->site[i];
+    if (!s->name)
+      continue;
+    fprintf(out, "%-24s %6u %10llu %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", s->name, s->line, s->waits,
+            s->polls, async_hist_percentile(&s->wait, 50) / us, async_hist_percentile(&s->wait, 99) / us,
+            s->wait.max / us, async_hist_percentile(&s->run, 99) / us, s->run.max / us);
+  }
+  if (p->dropped)
+    fprintf(out, "%llu resumes at untracked sites; raise ASYNC_PROFILE_SITES\n", p->dropped);
+}
+
+#endif /* ASYNC_PROFILE_H */
@@ -0,0 +1,208 @@
+/**
+ * \file
+ * Wait on several sources at once and learn which one fired.
+ *
+ * await(a || b) waits for either condition, but always tests a first, so a
+ * busy a starves b, and once it resumes the subroutine has to test both
+ * again to find out what happened. async_select instead holds a list of
+ * sources, each a function that checks for readiness and consumes the
+ * event in the same step. await_select() resumes as soon as one source
+ * fires, stores its index, and starts the next scan after it, so every
+ * source gets its turn:
+ *
+ *     async_select_clear(&st->sel);
+ *     key = async_select_add(&st->sel, key_pressed, NULL);
+ *     timeout = async_select_deadline(&st->sel, &st->deadline);
+ *     await_select(&st->sel, st->which);
+ *     if (st->which == timeout) ...
+ *
+ * async-shard.h and async-shm.h provide sources that receive from a
+ * mailbox (async_select_mailbox) or a shared-memory channel
+ * (async_select_shm); any other try-style call can be wrapped the same way.
+ *
+ * The select and anything its sources point to must be part of the async
+ * state, since they are consulted on every resume.
+ */
+
+#ifndef ASYNC_SELECT_H
+#define ASYNC_SELECT_H
+
+#include "async-clock.h"
+#include "async-sem.h"
+#include "async.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#ifndef ASYNC_SELECT_MAX
+#define ASYNC_SELECT_MAX 8
+#endif
+
+/**
+ * A wait source. poll(arg) returns non-zero if the source is ready, and
+ * consumes the event it reports (takes the semaphore, reads the
+ * message, ...) so no other waiter can claim it in between.
+ */
+struct async_source {
+  int (*poll)(void *arg);
+  void *arg;
+};
+
+struct async_select {
+  struct async_source src[ASYNC_SELECT_MAX];
+  unsigned n;
+  unsigned next;
+};
+
+/**
+ * A deadline source: fires once the monotonic clock passes `at`.
+ */
+struct async_deadline {
+  unsigned long long at;
+};
+
+/**
+ * Remove all sources from a select. The rotation position is kept so
+ * that a select rebuilt on every loop iteration stays fair.
+ */
+#define async_select_clear(sel) ((sel)->n = 0)
+
+/**
+ * Add a source to a select
+ *
+ * \return The index await_select() reports when this source fires, or
+ * -1 if the select already holds ASYNC_SELECT_MAX sources
+ */
+static inline int async_select_add(struct async_select *sel, int (*fn)(void *), void *arg)
+{
+  if (sel->n == ASYNC_SELECT_MAX)
+    return -1;
+  sel->src[sel->n].poll = fn;
+  sel->src[sel->n].arg = arg;
+  return (int)sel->n++;
+}
+
+static inline int async_select_sem_poll(void *arg)
+{
+  struct async_sem *s = (struct async_sem *)arg;
+  if (s->count == 0)
+    return 0;
+  --s->count;
+  return 1;
+}
+
+/**
+ * Add a semaphore source, which takes the semaphore when it fires
+ */
+#define async_select_sem(sel, s) async_select_add(sel, async_select_sem_poll, s)
+
+static inline int async_select_deadline_poll(void *arg)
+{
+  return async_clock_ns() >= ((struct async_deadline *)arg)->at;
+}
+
+/**
+ * Set a deadline the given number of nanoseconds from now
+ */
+#define async_deadline_set(d, ns) ((d)->at = async_clock_ns() + (ns))
+
+/**
+ * Add a deadline source
+ */
+#define async_select_deadline(sel, d) async_select_add(sel, async_select_deadline_poll, d)
+
+#ifndef _WIN32
+
+/**
+ * A file descriptor readiness source. revents holds what poll(2)
+ * reported when the source fired.
+ */
+struct async_fd {
+  int fd;
+  short events;
+  short revents;
+};
+
+/* Checks one descriptor on its own. async_select_poll() does not call
+ * this: it recognizes the descriptor sources by this function and checks
+ * them all with a single poll(2). */
+static inline int async_select_fd_poll(void *arg)
+{
+  struct async_fd *f = (struct async_fd *)arg;
+  struct pollfd p;
+  p.fd = f->fd;
+  p.events = f->events;
+  p.revents = 0;
+  if (poll(&p, 1, 0) <= 0)
+    return 0;
+  f->revents = p.revents;
+  return 1;
+}
+
+/**
+ * Add a file descriptor source
+ *
+ * \param f (struct async_fd *) The descriptor and the poll(2) events
+ * to wait for
+ */
+#define async_select_fd(sel, f) async_select_add(sel, async_select_fd_poll, f)
+
+#endif /* _WIN32 */
+
+/**
+ * Check each source once, starting after the one that fired last
+ *
+ * All file descriptor sources are checked together with one poll(2)
+ * call, so a resume costs at most one system call however many
+ * descriptors the select holds.
+ *
+ * \return The index of the first ready source, or -1 if none is ready
+ */
+static inline int async_select_poll(struct async_select *sel)
+{
+  unsigned i;
+#ifndef _WIN32
+  struct pollfd p[ASYNC_SELECT_MAX];
+  unsigned char slot[ASYNC_SELECT_MAX];
+  unsigned nfds = 0;
+  for (i = 0; i < sel->n; ++i) {
+    if (sel->src[i].poll == async_select_fd_poll) {
+      struct async_fd *f = (struct async_fd *)sel->src[i].arg;
+      p[nfds].fd = f->fd;
+      p[nfds].events = f->events;
+      p[nfds].revents = 0;
+      slot[i] = (unsigned char)nfds++;
+    }
+  }
+  if (nfds > 0 && poll(p, nfds, 0) <= 0)
+    nfds = 0;
+#endif
+  for (i = 0; i < sel->n; ++i) {
+    unsigned k = (sel->next + i) % sel->n;
+#ifndef _WIN32
+    if (sel->src[k].poll == async_select_fd_poll) {
+      if (nfds == 0 || p[slot[k]].revents == 0)
+        continue;
+      ((struct async_fd *)sel->src[k].arg)->revents = p[slot[k]].revents;
+      sel->next = k + 1;
+      return (int)k;
+    }
+#endif
+    if (sel->src[k].poll(sel->src[k].arg)) {
+      sel->next = k + 1;
+      return (int)k;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Wait until any source in a select fires
+ *
+ * \param sel (struct async_select *) The sources to wait on
+ * \param which (int lvalue) Receives the index of the source that fired
+ */
+#define await_select(sel, which) await(((which) = async_select_poll(sel)) >= 0)
+
+#endif /* ASYNC_SELECT_H */
@@ -0,0 +1,312 @@
+/**
+ * \file
+ * Thread-per-core shards with single-producer/single-consumer mailboxes.
+ *
+ * Each shard is a thread pinned to one core that runs its own driver loop
+ * over async subroutines. Task states never leave their shard: work for
+ * another shard is sent as a message to that shard's mailbox, and the
+ * receiving shard's subroutines pick it up with await_shard_recv(). A key
+ * partitioned workload simply sends each request to shard (key % n).
+ *
+ * Every ordered pair of shards has its own mailbox, so each mailbox has
+ * exactly one producer and one consumer and needs no read-modify-write
+ * atomics, only acquire loads and release stores.
+ *
+ * A shard's mailboxes are allocated and initialized by the shard's own
+ * thread after it has been pinned, so under a first-touch NUMA policy
+ * (the Linux default) they end up in memory local to that core. Task
+ * states allocated from within the shard's run function get the same
+ * placement.
+ *
+ * On Linux, pinning requires _GNU_SOURCE to be defined before the first
+ * system header is included; without it shards still work, but unpinned.
+ */
+
+#ifndef ASYNC_SHARD_H
+#define ASYNC_SHARD_H
+
+#include <stdlib.h>
+
+#include "async.h"
+#include "async-thread.h"
+
+#if !defined(_WIN32)
+#include <sched.h>
+#endif
+
+#ifndef ASYNC_SHARD_MAX
+#define ASYNC_SHARD_MAX 64
+#endif
+
+/* Must be a power of two */
+#ifndef ASYNC_MAILBOX_SIZE
+#define ASYNC_MAILBOX_SIZE 256
+#endif
+
+#ifndef ASYNC_CACHE_LINE
+#define ASYNC_CACHE_LINE 64
+#endif
+
+/**
+ * A bounded single-producer/single-consumer queue of pointers.
+ *
+ * head and tail are free-running counters on separate cache lines so the
+ * producer and consumer never write the same line.
+ */
+struct async_mailbox {
+  unsigned head;
+  char pad0[ASYNC_CACHE_LINE - sizeof(unsigned)];
+  unsigned tail;
+  char pad1[ASYNC_CACHE_LINE - sizeof(unsigned)];
+  void *slots[ASYNC_MAILBOX_SIZE];
+};
+
+struct async_shards;
+
+struct async_shard {
+  unsigned id;
+  unsigned next;                    /* round-robin position for receiving */
+  unsigned stop;
+  struct async_mailbox *inbox;      /* inbox[sender id], owned by this shard */
+  struct async_shards *group;
+  void *data;
+  async_thread thread;
+};
+
+/**
+ * A group of shards started together.
+ */
+struct async_shards {
+  unsigned n;
+  unsigned ready;
+  unsigned go;                      /* 0 while starting, 1 to run, 2 to abort */
+  void (*run)(struct async_shard *);
+  struct async_shard shard[ASYNC_SHARD_MAX];
+};
+
+/**
+ * Initialize an empty mailbox
+ */
+#define async_mailbox_init(mb) ((mb)->head = (mb)->tail = 0)
+
+/**
+ * Try to post a message; only the single producer may call this
+ *
+ * \return 1 if the message was posted, 0 if the mailbox is full
+ */
+static inline int async_mailbox_try_send(struct async_mailbox *mb, void *msg)
+{
+  unsigned tail = mb->tail;
+  if (tail - async_atomic_load(&mb->head) == ASYNC_MAILBOX_SIZE)
+    return 0;
+  mb->slots[tail & (ASYNC_MAILBOX_SIZE - 1)] = msg;
+  async_atomic_store(&mb->tail, tail + 1);
+  return 1;
+}
+
+/**
+ * Try to take a message; only the single consumer may call this
+ *
+ * \return 1 if a message was stored in *msg, 0 if the mailbox is empty
+ */
+static inline int async_mailbox_try_recv(struct async_mailbox *mb, void **msg)
+{
+  unsigned head = mb->head;
+  if (head == async_atomic_load(&mb->tail))
+    return 0;
+  *msg = mb->slots[head & (ASYNC_MAILBOX_SIZE - 1)];
+  async_atomic_store(&mb->head, head + 1);
+  return 1;
+}
+
+/**
+ * Wait for room in a mailbox and post a message
+ */
+#define await_mailbox_send(mb, msg) await(async_mailbox_try_send(mb, msg))
+
+/**
+ * Wait for a message
+ *
+ * \param msg (void * lvalue) Receives the message
+ */
+#define await_mailbox_recv(mb, msg) await(async_mailbox_try_recv(mb, (void **)&(msg)))
+
+/**
+ * A mailbox as a source for async-select.h. msg receives the message when
+ * the source fires.
+ */
+struct async_mailbox_source {
+  struct async_mailbox *mb;
+  void *msg;
+};
+
+static inline int async_select_mailbox_poll(void *arg)
+{
+  struct async_mailbox_source *m = (struct async_mailbox_source *)arg;
+  return async_mailbox_try_recv(m->mb, &m->msg);
+}
+
+/**
+ * Add a mailbox source to a select
+ *
+ * \param m (struct async_mailbox_source *) The mailbox, and where the
+ * message is stored
+ */
+#define async_select_mailbox(sel, m) async_select_add(sel, async_select_mailbox_poll, m)
+
+/**
+ * Try to send a message from one shard to another
+ *
+ * Must be called from the sending shard's thread.
+ *
+ * \param from (struct async_shard *) The sending shard
+ * \param to The id of the receiving shard
+ */
+#define async_shard_try_send(from, to, msg) \
+  async_mailbox_try_send(&(from)->group->shard[to].inbox[(from)->id], msg)
+
+/**
+ * Try to receive a message sent to this shard from any shard
+ *
+ * Senders are visited round-robin so one busy sender cannot starve others.
+ *
+ * \return 1 if a message was stored in *msg, 0 if all mailboxes are empty
+ */
+static inline int async_shard_try_recv(struct async_shard *shard, void **msg)
+{
+  unsigned i, n = shard->group->n;
+  for (i = 0; i < n; ++i) {
+    unsigned from = (shard->next + i) % n;
+    if (async_mailbox_try_recv(&shard->inbox[from], msg)) {
+      shard->next = (from + 1) % n;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Wait for room in the target shard's mailbox and send a message
+ */
+#define await_shard_send(from, to, msg) await(async_shard_try_send(from, to, msg))
+
+/**
+ * Wait for a message from any shard
+ *
+ * \param msg (void * lvalue) Receives the message
+ */
+#define await_shard_recv(shard, msg) await(async_shard_try_recv(shard, (void **)&(msg)))
+
+/**
+ * Check whether the shard's driver loop should return
+ */
+#define async_shard_stopping(shard) (async_atomic_load(&(shard)->stop) != 0)
+
+static inline void async_shard_pin(unsigned cpu)
+{
+#if defined(_WIN32)
+  SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__) && defined(CPU_SET)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+
+static inline async_thread_fn(async_shard_main, arg)
+{
+  struct async_shard *shard = (struct async_shard *)arg;
+  struct async_shards *group = shard->group;
+  unsigned i;
+
+  async_shard_pin(shard->id);
+  /* allocated and first touched by the pinned thread, so the inbox comes
+   * from this thread's malloc arena and lands on the local node; a failed
+   * allocation is left as NULL for async_shards_start() to see */
+  shard->inbox = (struct async_mailbox *)malloc(group->n * sizeof(struct async_mailbox));
+  if (shard->inbox)
+    for (i = 0; i < group->n; ++i)
+      async_mailbox_init(&shard->inbox[i]);
+  async_atomic_add(&group->ready, 1);
+  while ((i = async_atomic_load(&group->go)) == 0)
+    ;
+  if (i == 1)
+    group->run(shard);
+  async_thread_return;
+}
+
+/**
+ * Start one pinned shard per core
+ *
+ * Shard i is pinned to core i and calls run(&group->shard[i]) once every
+ * shard's mailboxes are ready, which is also when this function returns.
+ * run() is the shard's driver loop and should return once
+ * async_shard_stopping() is true.
+ *
+ * \param group (struct async_shards *) The group to start
+ * \param n The number of shards, at most ASYNC_SHARD_MAX
+ * \param run The driver loop each shard runs
+ * \param data Stored in each shard's data member
+ * \return 0 on success, -1 on failure
+ */
+static inline int async_shards_start(struct async_shards *group, unsigned n,
+                                     void (*run)(struct async_shard *), void *data)
+{
+  unsigned i, started;
+  if (n == 0 || n > ASYNC_SHARD_MAX)
+    return -1;
+  group->n = n;
+  group->ready = 0;
+  group->go = 0;
+  group->run = run;
+  for (i = 0; i < n; ++i) {
+    struct async_shard *shard = &group->shard[i];
+    shard->id = i;
+    shard->next = 0;
+    shard->stop = 0;
+    shard->group = group;
+    shard->data = data;
+    shard->inbox = NULL;
+  }
+  for (started = 0; started < n; ++started)
+    if (async_thread_create(&group->shard[started].thread, async_shard_main, &group->shard[started]) != 0)
+      break;
+  /* no shard may send before every inbox is initialized */
+  if (started == n) {
+    while (async_atomic_load(&group->ready) != n)
+      ;
+    for (i = 0; i < n; ++i)
+      if (!group->shard[i].inbox)
+        break;
+  }
+  if (started < n || i < n) {
+    async_atomic_store(&group->go, 2);
+    for (i = 0; i < started; ++i) {
+      async_thread_join(group->shard[i].thread);
+      free(group->shard[i].inbox);
+    }
+    return -1;
+  }
+  async_atomic_store(&group->go, 1);
+  return 0;
+}
+
+/**
+ * Ask every shard to stop, wait for their driver loops to return and
+ * release their mailboxes
+ */
+static inline void async_shards_stop(struct async_shards *group)
+{
+  unsigned i;
+  for (i = 0; i < group->n; ++i)
+    async_atomic_store(&group->shard[i].stop, 1);
+  for (i = 0; i < group->n; ++i) {
+    async_thread_join(group->shard[i].thread);
+    free(group->shard[i].inbox);
+  }
+}
+
+#endif /* ASYNC_SHARD_H */
@@ -0,0 +1,318 @@
+/**
+ * \file
+ * A single-producer/single-consumer message channel between processes,
+ * backed by a ring buffer in shared memory.
+ *
+ * Messages are copied straight into the shared ring, so sending or
+ * receiving costs no system call while both sides are busy. A process
+ * whose async subroutines are all waiting on the channel can put its
+ * driver loop to sleep with async_shm_wait_recv() or async_shm_wait_send();
+ * only then does the peer pay for an eventfd write to wake it up, and a
+ * single wakeup lets the sleeper drain every message queued meanwhile.
+ *
+ *     struct async_shm_chan ch;
+ *     async_shm_create(&ch, 1024, 256);
+ *     if (fork() == 0) {
+ *       ... subroutines use await_shm_send(&ch, buf, len, rc) ...
+ *     } else {
+ *       ... subroutines use await_shm_recv(&ch, buf, len) ...
+ *     }
+ *
+ * Processes that are not related by fork() can attach to the same channel
+ * by passing the three descriptors over a Unix socket and calling
+ * async_shm_attach().
+ *
+ * This header requires Linux (eventfd).
+ */
+
+#ifndef ASYNC_SHM_H
+#define ASYNC_SHM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "async.h"
+#include "async-thread.h"
+
+#ifndef ASYNC_CACHE_LINE
+#define ASYNC_CACHE_LINE 64
+#endif
+
+/**
+ * The shared part of a channel, at the start of the mapping. The slots
+ * follow it, each holding a length followed by slot_size bytes.
+ */
+struct async_shm_ring {
+  unsigned head;              /* written by the receiver */
+  unsigned recv_parked;
+  char pad0[ASYNC_CACHE_LINE - 2 * sizeof(unsigned)];
+  unsigned tail;              /* written by the sender */
+  unsigned send_parked;
+  char pad1[ASYNC_CACHE_LINE - 2 * sizeof(unsigned)];
+  unsigned slots;             /* a power of two */
+  unsigned slot_size;
+};
+
+/**
+ * A process's handle on a channel. The ring's geometry is kept here too,
+ * since the copy in shared memory can be overwritten by the peer.
+ */
+struct async_shm_chan {
+  struct async_shm_ring *ring;
+  size_t map_size;
+  unsigned slots;
+  unsigned slot_size;
+  int fd;                     /* the shared memory */
+  int recv_efd;               /* wakes a parked receiver */
+  int send_efd;               /* wakes a parked sender */
+};
+
+#define async_shm_stride(ch) (sizeof(unsigned) + (ch)->slot_size)
+#define async_shm_slot(ch, i) \
+  ((unsigned char *)((ch)->ring + 1) + ((i) & ((ch)->slots - 1)) * async_shm_stride(ch))
+
+static inline int async_shm_map(struct async_shm_chan *ch, size_t size)
+{
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ch->fd, 0);
+  if (p == MAP_FAILED)
+    return -1;
+  ch->ring = (struct async_shm_ring *)p;
+  ch->map_size = size;
+  return 0;
+}
+
+/**
+ * Create a channel
+ *
+ * \param ch (struct async_shm_chan *) The channel
+ * \param slots The number of messages the ring holds, a power of two
+ * \param slot_size The largest message in bytes
+ * \return 0 on success, -1 on failure
+ */
+static inline int async_shm_create(struct async_shm_chan *ch, unsigned slots, unsigned slot_size)
+{
+  size_t size = sizeof(struct async_shm_ring) + (size_t)slots * (sizeof(unsigned) + slot_size);
+  if (slots == 0 || (slots & (slots - 1)) != 0)
+    return -1;
+  ch->ring = NULL;
+  ch->fd = ch->recv_efd = ch->send_efd = -1;
+#ifdef MFD_CLOEXEC
+  ch->fd = memfd_create("async-shm", 0);
+#else
+  {
+    char name[64];
+    static unsigned seq;
+    snprintf(name, sizeof(name), "/async-shm-%ld-%u", (long)getpid(), seq++);
+    ch->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (ch->fd >= 0)
+      shm_unlink(name);
+  }
+#endif
+  if (ch->fd < 0 || ftruncate(ch->fd, (off_t)size) != 0 || async_shm_map(ch, size) != 0)
+    goto fail;
+  ch->recv_efd = eventfd(0, 0);
+  ch->send_efd = eventfd(0, 0);
+  if (ch->recv_efd < 0 || ch->send_efd < 0)
+    goto fail;
+  memset(ch->ring, 0, sizeof(struct async_shm_ring));
+  ch->ring->slots = ch->slots = slots;
+  ch->ring->slot_size = ch->slot_size = slot_size;
+  return 0;
+fail:
+  if (ch->ring) munmap(ch->ring, ch->map_size);
+  if (ch->fd >= 0) close(ch->fd);
+  if (ch->recv_efd >= 0) close(ch->recv_efd);
+  if (ch->send_efd >= 0) close(ch->send_efd);
+  return -1;
+}
+
+/**
+ * Attach to a channel created by another process
+ *
+ * \param ch (struct async_shm_chan *) The channel
+ * \param fd, recv_efd, send_efd The creator's descriptors, received
+ * over a Unix socket
+ * \return 0 on success, -1 on failure, including a ring whose header does
+ * not describe a valid ring that fits in the shared memory
+ */
+static inline int async_shm_attach(struct async_shm_chan *ch, int fd, int recv_efd, int send_efd)
+{
+  struct stat st;
+  size_t size;
+  ch->fd = fd;
+  ch->recv_efd = recv_efd;
+  ch->send_efd = send_efd;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct async_shm_ring))
+    return -1;
+  /* map the header alone first to learn the ring's geometry */
+  if (async_shm_map(ch, sizeof(struct async_shm_ring)) != 0)
+    return -1;
+  ch->slots = ch->ring->slots;
+  ch->slot_size = ch->ring->slot_size;
+  munmap(ch->ring, ch->map_size);
+  if (ch->slots == 0 || (ch->slots & (ch->slots - 1)) != 0)
+    return -1;
+  size = sizeof(struct async_shm_ring) + (size_t)ch->slots * async_shm_stride(ch);
+  if ((size_t)st.st_size < size)
+    return -1;
+  return async_shm_map(ch, size);
+}
+
+/**
+ * Unmap a channel and close this process's descriptors
+ */
+static inline void async_shm_close(struct async_shm_chan *ch)
+{
+  munmap(ch->ring, ch->map_size);
+  close(ch->fd);
+  close(ch->recv_efd);
+  close(ch->send_efd);
+}
+
+static inline void async_shm_notify(int efd)
+{
+  unsigned long long one = 1;
+  ssize_t rc = write(efd, &one, sizeof(one));
+  (void)rc;
+}
+
+/**
+ * Try to send a message
+ *
+ * \return 1 if the message was queued, 0 if the ring is full, -1 if the
+ * message is longer than slot_size and can never be sent
+ */
+static inline int async_shm_try_send(struct async_shm_chan *ch, const void *buf, unsigned len)
+{
+  struct async_shm_ring *r = ch->ring;
+  unsigned tail = r->tail;
+  unsigned char *slot;
+  if (len > ch->slot_size)
+    return -1;
+  if (tail - async_atomic_load(&r->head) == ch->slots)
+    return 0;
+  slot = async_shm_slot(ch, tail);
+  memcpy(slot, &len, sizeof(len));
+  memcpy(slot + sizeof(len), buf, len);
+  async_atomic_store(&r->tail, tail + 1);
+  /* pairs with the fence in async_shm_wait_recv() */
+  async_atomic_fence();
+  if (async_atomic_load(&r->recv_parked))
+    async_shm_notify(ch->recv_efd);
+  return 1;
+}
+
+/**
+ * Try to receive a message
+ *
+ * \param buf Receives the message; must hold at least slot_size bytes
+ * \param len (unsigned *) Receives the message length. A length the peer
+ * wrote beyond slot_size is cut down to slot_size.
+ * \return 1 if a message was received, 0 if the ring is empty
+ */
+static inline int async_shm_try_recv(struct async_shm_chan *ch, void *buf, unsigned *len)
+{
+  struct async_shm_ring *r = ch->ring;
+  unsigned head = r->head;
+  unsigned char *slot;
+  if (head == async_atomic_load(&r->tail))
+    return 0;
+  slot = async_shm_slot(ch, head);
+  memcpy(len, slot, sizeof(*len));
+  if (*len > ch->slot_size)
+    *len = ch->slot_size;
+  memcpy(buf, slot + sizeof(*len), *len);
+  async_atomic_store(&r->head, head + 1);
+  /* pairs with the fence in async_shm_wait_send() */
+  async_atomic_fence();
+  if (async_atomic_load(&r->send_parked))
+    async_shm_notify(ch->send_efd);
+  return 1;
+}
+
+/**
+ * Wait for room in the ring and send a message
+ *
+ * \param ch (struct async_shm_chan *) The channel
+ * \param buf (const void *) The message
+ * \param len (unsigned) The message length
+ * \param rc (int lvalue) Set to 1 once the message is queued, or to -1 at
+ * once if it is longer than slot_size and was not sent
+ */
+#define await_shm_send(ch, buf, len, rc) await(((rc) = async_shm_try_send(ch, buf, len)) != 0)
+
+/**
+ * Wait for a message
+ *
+ * \param ch (struct async_shm_chan *) The channel
+ * \param buf (void *) Receives the message; must hold slot_size bytes
+ * \param len (unsigned lvalue) Receives the message length
+ */
+#define await_shm_recv(ch, buf, len) await(async_shm_try_recv(ch, buf, &(len)))
+
+/**
+ * A channel as a source for async-select.h. buf and len receive the
+ * message when the source fires; buf must hold slot_size bytes.
+ */
+struct async_shm_source {
+  struct async_shm_chan *ch;
+  void *buf;
+  unsigned len;
+};
+
+static inline int async_select_shm_poll(void *arg)
+{
+  struct async_shm_source *s = (struct async_shm_source *)arg;
+  return async_shm_try_recv(s->ch, s->buf, &s->len);
+}
+
+/**
+ * Add a channel's receiving end to a select
+ *
+ * \param s (struct async_shm_source *) The channel, and where the message
+ * is stored
+ */
+#define async_select_shm(sel, s) async_select_add(sel, async_select_shm_poll, s)
+
+/**
+ * Put the receiving driver loop to sleep until a message is available
+ *
+ * Call this from the driver loop, not from an async subroutine, once every
+ * subroutine it drives is waiting on the channel.
+ */
+static inline void async_shm_wait_recv(struct async_shm_chan *ch)
+{
+  struct async_shm_ring *r = ch->ring;
+  unsigned long long n;
+  async_atomic_store(&r->recv_parked, 1);
+  async_atomic_fence();
+  /* recheck so a message sent before we parked isn't missed */
+  if (r->head == async_atomic_load(&r->tail)) {
+    ssize_t rc = read(ch->recv_efd, &n, sizeof(n));
+    (void)rc;
+  }
+  async_atomic_store(&r->recv_parked, 0);
+}
+
+/**
+ * Put the sending driver loop to sleep until the ring has room
+ */
+static inline void async_shm_wait_send(struct async_shm_chan *ch)
+{
+  struct async_shm_ring *r = ch->ring;
+  unsigned long long n;
+  async_atomic_store(&r->send_parked, 1);
+  async_atomic_fence();
+  if (r->tail - async_atomic_load(&r->head) == ch->slots) {
+    ssize_t rc = read(ch->send_efd, &n, sizeof(n));
+    (void)rc;
+  }
+  async_atomic_store(&r->send_parked, 0);
+}
+
+#endif /* ASYNC_SHM_H */
@@ -0,0 +1,278 @@
+/**
+ * \file
+ * Save and restore the state of async subroutines across restarts.
+ *
+ * An async subroutine's progress is entirely in its state struct: the
+ * continuation in _async_k plus whatever locals were lifted into it. If the
+ * states of long-running subroutines, and the semaphores, queues and other
+ * structs they wait on, are registered with a snapshot, they can be written
+ * to a file and copied back on the next start, and the subroutines resume
+ * where they left off instead of starting over.
+ *
+ *     async_snapshot_init(&snap, MY_SNAPSHOT_VERSION);
+ *     async_snapshot_add(&snap, 1, &workflow, NULL, NULL);
+ *     async_snapshot_add(&snap, 2, &queue, fix_queue_pointers, &ctx);
+ *     if (async_snapshot_load(&snap, "state.snap") < 0)
+ *       async_init(&workflow);
+ *     ...
+ *     async_snapshot_save(&snap, "state.snap");
+ *
+ * Restrictions:
+ *
+ * 1. _async_k holds the source line of the await the subroutine is parked
+ *    at, so a snapshot is only valid for the exact build that wrote it.
+ *    Change the version passed to async_snapshot_init() with every release.
+ * 2. Pointers saved in a state are meaningless in the new process. Register
+ *    a relocate hook to repair them after the state has been restored.
+ * 3. Snapshots use the host's byte order and struct layout.
+ */
+
+#ifndef ASYNC_SNAPSHOT_H
+#define ASYNC_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "async.h"
+
+#ifndef ASYNC_SNAPSHOT_MAX
+#define ASYNC_SNAPSHOT_MAX 64
+#endif
+
+#define ASYNC_SNAPSHOT_MAGIC 0x504E5341u /* "ASNP" */
+
+struct async_snapshot_entry {
+  unsigned id;
+  void *state;
+  unsigned long long size;
+  void (*relocate)(void *state, void *ctx);
+  void *ctx;
+};
+
+struct async_snapshot {
+  unsigned version;
+  unsigned n;
+  struct async_snapshot_entry entry[ASYNC_SNAPSHOT_MAX];
+};
+
+/* on-disk headers */
+struct async_snapshot_file { unsigned magic, version, n; };
+struct async_snapshot_record { unsigned id; unsigned long long size; };
+
+/**
+ * Initialize an empty snapshot
+ *
+ * \param snap (struct async_snapshot *) The snapshot
+ * \param v (unsigned) The version written to and expected in the file
+ */
+#define async_snapshot_init(snap, v) ((snap)->version = (v), (snap)->n = 0)
+
+/**
+ * Register a struct with a snapshot
+ *
+ * \param id A number identifying this struct, stable across restarts
+ * \param state Pointer to the struct
+ * \param size The size of the struct
+ * \param relocate Called as relocate(state, ctx) after the struct is
+ * restored, or NULL
+ * \return 0 on success, -1 if the snapshot is full
+ */
+static inline int async_snapshot_register(struct async_snapshot *snap, unsigned id, void *state, size_t size,
+                                          void (*relocate)(void *, void *), void *ctx)
+{
+  struct async_snapshot_entry *e;
+  if (snap->n == ASYNC_SNAPSHOT_MAX)
+    return -1;
+  e = &snap->entry[snap->n++];
+  e->id = id;
+  e->state = state;
+  e->size = size;
+  e->relocate = relocate;
+  e->ctx = ctx;
+  return 0;
+}
+
+/**
+ * Register a struct, taking its size from its type
+ */
+#define async_snapshot_add(snap, id, state, relocate, ctx) \
+  async_snapshot_register(snap, id, state, sizeof(*(state)), relocate, ctx)
+
+#ifndef _WIN32
+/* fsync the directory holding path */
+static inline int async_snapshot_sync_dir(const char *path)
+{
+  char dir[1024];
+  const char *slash = strrchr(path, '/');
+  size_t len = slash ? (size_t)(slash - path) : 0;
+  int fd, rc;
+
+  if (!slash)
+    strcpy(dir, ".");
+  else if (len == 0)
+    strcpy(dir, "/");
+  else if (len < sizeof(dir)) {
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+  } else
+    return -1;
+  if ((fd = open(dir, O_RDONLY)) < 0)
+    return -1;
+  rc = fsync(fd);
+  close(fd);
+  return rc == 0 ? 0 : -1;
+}
+#endif
+
+/**
+ * Write every registered struct to a file
+ *
+ * The snapshot is written to path.tmp, flushed to disk and then renamed
+ * over path, and the directory is flushed after the rename, so a crash
+ * during the save leaves the previous snapshot intact and a successful
+ * save survives a crash.
+ *
+ * \return 0 on success, -1 on failure
+ */
+static inline int async_snapshot_save(const struct async_snapshot *snap, const char *path)
+{
+  char tmp[1024];
+  struct async_snapshot_file hdr;
+  unsigned i;
+  FILE *f;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp) || !(f = fopen(tmp, "wb")))
+    return -1;
+  hdr.magic = ASYNC_SNAPSHOT_MAGIC;
+  hdr.version = snap->version;
+  hdr.n = snap->n;
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+    goto fail;
+  for (i = 0; i < snap->n; ++i) {
+    const struct async_snapshot_entry *e = &snap->entry[i];
+    struct async_snapshot_record rec;
+    rec.id = e->id;
+    rec.size = e->size;
+    if (fwrite(&rec, sizeof(rec), 1, f) != 1 || fwrite(e->state, (size_t)e->size, 1, f) != 1)
+      goto fail;
+  }
+  if (fflush(f) != 0)
+    goto fail;
+#ifdef _WIN32
+  if (_commit(_fileno(f)) != 0)
+    goto fail;
+#else
+  if (fsync(fileno(f)) != 0)
+    goto fail;
+#endif
+  if (fclose(f) != 0) {
+    remove(tmp);
+    return -1;
+  }
+#ifdef _WIN32
+  /* unlike rename, this replaces an existing snapshot in one step, and
+   * write-through returns only once the move is on disk */
+  if (!MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    remove(tmp);
+    return -1;
+  }
+  return 0;
+#else
+  if (rename(tmp, path) != 0) {
+    remove(tmp);
+    return -1;
+  }
+  /* the rename itself is only durable once the directory is synced */
+  return async_snapshot_sync_dir(path);
+#endif
+fail:
+  fclose(f);
+  remove(tmp);
+  return -1;
+}
+
+/**
+ * Restore registered structs from a file
+ *
+ * Records are matched to registered structs by id and size. Registered
+ * structs without a matching record, and records without a registered
+ * struct, are left alone; relocate hooks run only for restored structs.
+ * Nothing is restored unless the whole file is valid.
+ *
+ * \return The number of structs restored, or -1 if the file is missing,
+ * truncated, or has the wrong version
+ */
+static inline int async_snapshot_load(struct async_snapshot *snap, const char *path)
+{
+  struct async_snapshot_file hdr;
+  struct async_snapshot_record rec;
+  unsigned char restored[ASYNC_SNAPSHOT_MAX];
+  unsigned char *buf = NULL;
+  unsigned i, j;
+  size_t pos;
+  long end;
+  int count = 0;
+  FILE *f = fopen(path, "rb");
+
+  if (!f)
+    return -1;
+  /* read the whole file first, so a read error cannot leave the registered
+   * structs half restored */
+  if (fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < (long)sizeof(hdr) || fseek(f, 0, SEEK_SET) != 0
+      || !(buf = (unsigned char *)malloc((size_t)end)) || fread(buf, (size_t)end, 1, f) != 1) {
+    fclose(f);
+    free(buf);
+    return -1;
+  }
+  fclose(f);
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.magic != ASYNC_SNAPSHOT_MAGIC || hdr.version != snap->version)
+    goto fail;
+
+  /* check every record fits before touching any registered struct */
+  for (i = 0, pos = sizeof(hdr); i < hdr.n; ++i) {
+    if ((size_t)end - pos < sizeof(rec))
+      goto fail;
+    memcpy(&rec, buf + pos, sizeof(rec));
+    pos += sizeof(rec);
+    if (rec.size > (unsigned long long)((size_t)end - pos))
+      goto fail;
+    pos += (size_t)rec.size;
+  }
+
+  memset(restored, 0, sizeof(restored));
+  for (i = 0, pos = sizeof(hdr); i < hdr.n; ++i) {
+    memcpy(&rec, buf + pos, sizeof(rec));
+    pos += sizeof(rec);
+    for (j = 0; j < snap->n; ++j) {
+      struct async_snapshot_entry *e = &snap->entry[j];
+      if (!restored[j] && e->id == rec.id && e->size == rec.size) {
+        memcpy(e->state, buf + pos, (size_t)rec.size);
+        restored[j] = 1;
+        ++count;
+        break;
+      }
+    }
+    pos += (size_t)rec.size;
+  }
+  free(buf);
+
+  for (j = 0; j < snap->n; ++j)
+    if (restored[j] && snap->entry[j].relocate)
+      snap->entry[j].relocate(snap->entry[j].state, snap->entry[j].ctx);
+  return count;
+fail:
+  free(buf);
+  return -1;
+}
+
+#endif /* ASYNC_SNAPSHOT_H */
@@ -0,0 +1,85 @@
+/**
+ * \file
+ * Minimal portable threading and atomics used by the optional async.h
+ * extensions that hand work to other threads. async.h itself does not
+ * need any of this.
+ *
+ * Only the handful of operations the extensions use are wrapped:
+ *
+ * - async_thread_fn(name, arg) declares a thread entry point, which must
+ *   finish with async_thread_return.
+ * - async_thread_create/join, async_mutex_*, async_cond_* map directly to
+ *   their pthreads or Win32 counterparts.
+ * - async_atomic_load/store/add operate on unsigned counters shared between
+ *   threads, with acquire loads, release stores and fetch-and-add.
+ * - async_atomic_fence() is a full barrier, for the rare store-then-load
+ *   handshakes that acquire/release ordering does not cover.
+ */
+
+#ifndef ASYNC_THREAD_H
+#define ASYNC_THREAD_H
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef HANDLE async_thread;
+typedef CRITICAL_SECTION async_mutex;
+typedef CONDITION_VARIABLE async_cond;
+
+#define async_thread_fn(name, arg) DWORD WINAPI name(LPVOID arg)
+#define async_thread_return return 0
+
+#define async_thread_create(t, f, a) ((*(t) = CreateThread(NULL, 0, f, a, 0, NULL)) != NULL ? 0 : -1)
+#define async_thread_join(t) (WaitForSingleObject(t, INFINITE), CloseHandle(t))
+
+#define async_mutex_init(m) InitializeCriticalSection(m)
+#define async_mutex_destroy(m) DeleteCriticalSection(m)
+#define async_mutex_lock(m) EnterCriticalSection(m)
+#define async_mutex_unlock(m) LeaveCriticalSection(m)
+
+#define async_cond_init(c) InitializeConditionVariable(c)
+#define async_cond_destroy(c) ((void)(c))
+#define async_cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define async_cond_signal(c) WakeConditionVariable(c)
+#define async_cond_broadcast(c) WakeAllConditionVariable(c)
+
+/* Interlocked operations are full barriers, which subsumes acquire/release */
+#define async_atomic_load(p) ((unsigned)InterlockedCompareExchange((volatile LONG *)(p), 0, 0))
+#define async_atomic_store(p, v) ((void)InterlockedExchange((volatile LONG *)(p), (LONG)(v)))
+#define async_atomic_add(p, v) ((unsigned)InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(v)))
+#define async_atomic_fence() MemoryBarrier()
+
+#else /* _WIN32 */
+
+#include <pthread.h>
+
+typedef pthread_t async_thread;
+typedef pthread_mutex_t async_mutex;
+typedef pthread_cond_t async_cond;
+
+#define async_thread_fn(name, arg) void *name(void *arg)
+#define async_thread_return return NULL
+
+#define async_thread_create(t, f, a) (pthread_create(t, NULL, f, a) == 0 ? 0 : -1)
+#define async_thread_join(t) pthread_join(t, NULL)
+
+#define async_mutex_init(m) pthread_mutex_init(m, NULL)
+#define async_mutex_destroy(m) pthread_mutex_destroy(m)
+#define async_mutex_lock(m) pthread_mutex_lock(m)
+#define async_mutex_unlock(m) pthread_mutex_unlock(m)
+
+#define async_cond_init(c) pthread_cond_init(c, NULL)
+#define async_cond_destroy(c) pthread_cond_destroy(c)
+#define async_cond_wait(c, m) pthread_cond_wait(c, m)
+#define async_cond_signal(c) pthread_cond_signal(c)
+#define async_cond_broadcast(c) pthread_cond_broadcast(c)
+
+#define async_atomic_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define async_atomic_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define async_atomic_add(p, v) __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL)
+#define async_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif /* _WIN32 */
+
+#endif /* ASYNC_THREAD_H */
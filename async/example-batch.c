@@ -0,0 +1,83 @@
+/**
+ * This example group-commits records from several writers. Each writer
+ * submits one record with await_batch() and waits for it to be committed;
+ * a batch is committed as soon as it holds four records, or 3 ms after its
+ * first record arrived. Writers arrive one millisecond apart, except for a
+ * burst of five at once, so both kinds of flush show up.
+ *
+ * Time is simulated so the run is the same every time: each pass of the
+ * driver loop advances the clock by one millisecond.
+ */
+
+#include <stdio.h>
+
+#include "async-batch.h"
+
+#define NUM_WRITERS 10
+
+static unsigned long long now;
+static unsigned commits;
+
+static void
+commit_records(void *ctx, struct async_batch_req **reqs, unsigned n)
+{
+	unsigned i;
+	(void)ctx;
+	++commits;
+	printf("commit %u at %llu ms:", commits, now);
+	for (i = 0; i < n; ++i) {
+		printf(" %s", (const char *)reqs[i]->item);
+		reqs[i]->result = (int)commits;
+	}
+	printf("\n");
+}
+
+static struct async_batch batch;
+
+typedef struct {
+	async_state;
+	struct async_batch_req req;
+	unsigned long long arrive;
+	char record[16];
+} writer_state;
+
+static async
+writer(writer_state *st)
+{
+	async_begin(st);
+
+	await(now >= st->arrive);
+	await_batch(&batch, &st->req, st->record, now);
+
+	async_end;
+}
+
+int
+example_batch(void)
+{
+	writer_state writers[NUM_WRITERS];
+	int i, running;
+
+	now = 0;
+	commits = 0;
+	init_batch(&batch, commit_records, NULL, 4, 3);
+	for (i = 0; i < NUM_WRITERS; ++i) {
+		async_init(&writers[i]);
+		/* writers 3 to 7 arrive together */
+		writers[i].arrive = i < 3 ? i : i < 8 ? 3 : i - 4;
+		sprintf(writers[i].record, "r%d", i);
+	}
+
+	do {
+		running = 0;
+		for (i = 0; i < NUM_WRITERS; ++i)
+			running += !writer(&writers[i]);
+		++now;
+	} while (running);
+
+	printf("commit of each record:");
+	for (i = 0; i < NUM_WRITERS; ++i)
+		printf(" %s=%d", writers[i].record, writers[i].req.result);
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * This example runs a blocking call from several async subroutines at
+ * once. Each call is handed to a small worker pool with await_blocking(),
+ * so the driver loop keeps running the other subroutines while the calls
+ * sleep on the workers.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+
+#include "async-blocking.h"
+
+#define NUM_LOOKUPS 6
+
+/* Stands in for a call with no non-blocking form, such as getaddrinfo(). */
+static void *
+slow_square(void *arg)
+{
+	size_t n = (size_t)arg;
+#ifdef _WIN32
+	Sleep(5);
+#else
+	usleep(5000);
+#endif
+	return (void *)(n * n);
+}
+
+typedef struct {
+	async_state;
+	struct async_blocking job;
+	size_t n;
+	void *result;
+} lookup_state;
+
+static struct async_pool pool;
+
+static async
+lookup(lookup_state *st)
+{
+	async_begin(st);
+
+	await_blocking(&pool, &st->job, slow_square, (void *)st->n, st->result);
+
+	async_end;
+}
+
+int
+example_blocking(void)
+{
+	lookup_state lookups[NUM_LOOKUPS];
+	struct async_pool_stats stats;
+	int i, running;
+
+	/* two workers, and room for only two queued calls */
+	if (async_pool_init(&pool, 2, 2) != 0) {
+		printf("could not start the worker pool\n");
+		return -1;
+	}
+	for (i = 0; i < NUM_LOOKUPS; ++i) {
+		async_init(&lookups[i]);
+		lookups[i].n = (size_t)i + 1;
+	}
+
+	do {
+		running = 0;
+		for (i = 0; i < NUM_LOOKUPS; ++i)
+			running += !lookup(&lookups[i]);
+	} while (running);
+
+	for (i = 0; i < NUM_LOOKUPS; ++i)
+		printf("%u squared is %u\n", (unsigned)lookups[i].n,
+		       (unsigned)(size_t)lookups[i].result);
+	async_pool_stats(&pool, &stats);
+	printf("%llu blocking calls finished\n", stats.calls);
+
+	async_pool_destroy(&pool);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * This example shows the two ways of keeping long-running work from
+ * stalling a driver loop. A cruncher works through a large array but
+ * yields whenever its time slice is used up, so a ticker on the same loop
+ * keeps running. A watchdog wraps every resume and reports the one
+ * subroutine that does not yield: it stalls the loop for 30 ms in a
+ * single resume, and the report names the lines that bracket the stall.
+ */
+
+#include <stdio.h>
+
+#include "async-budget.h"
+
+#define NUM_ITEMS 4000000
+
+static unsigned ticks_seen;
+
+typedef struct {
+	async_state;
+	struct async_budget budget;
+	unsigned i, slices;
+	unsigned long long sum;
+} cruncher_state;
+
+static async
+cruncher(cruncher_state *st)
+{
+	async_begin(st);
+
+	/* slices of at most 200 microseconds */
+	async_budget_init(&st->budget, 200 * async_ticks_per_us());
+	for (st->i = 0, st->slices = 1; st->i < NUM_ITEMS; ++st->i) {
+		st->sum += st->i % 7;
+		if (async_over_budget(&st->budget))
+			++st->slices;
+		async_yield_if_over_budget(&st->budget);
+	}
+
+	async_end;
+}
+
+static async
+ticker(struct async *pt)
+{
+	async_begin(pt);
+
+	while (1) {
+		++ticks_seen;
+		async_yield;
+	}
+
+	async_end;
+}
+
+static async
+stall(struct async *pt)
+{
+	unsigned long long until;
+
+	async_begin(pt);
+
+	async_yield;
+	/* 30 ms of work without a single await */
+	until = async_ticks() + 30000 * async_ticks_per_us();
+	while (async_ticks() < until)
+		;
+	async_yield;
+
+	async_end;
+}
+
+static void
+report_overrun(void *ctx, const char *name, unsigned from, unsigned to, unsigned long long ticks)
+{
+	(void)ctx;
+	(void)ticks;
+	printf("watchdog: %s ran over 10 ms between lines %u and %u\n", name, from, to);
+}
+
+int
+example_budget(void)
+{
+	struct async_watchdog wd;
+	cruncher_state crunch;
+	struct async tick_pt, stall_pt;
+
+	async_watchdog_init(&wd, 10000 * async_ticks_per_us(), report_overrun, NULL);
+	async_init(&crunch);
+	crunch.sum = 0;
+	async_init(&tick_pt);
+	async_init(&stall_pt);
+	ticks_seen = 0;
+
+	while (!async_watch(&wd, cruncher, &crunch)) {
+		async_watch(&wd, ticker, &tick_pt);
+		async_watch(&wd, stall, &stall_pt);
+	}
+
+	printf("cruncher finished in %s slices, and the ticker kept running: %s\n",
+	       crunch.slices > 1 ? "several" : "one", ticks_seen >= crunch.slices ? "yes" : "no");
+	return 0;
+}
@@ -41,6 +41,7 @@
 #include <stdio.h>
 
 #include "async-sem.h"
+#include "async-log.h"
 
 #define NUM_ITEMS 32
 #define BUFSIZE 8
@@ -48,10 +49,17 @@
 static int buffer[BUFSIZE];
 static int bufptr;
 
+/*
+ * The producer and consumer log into a ring instead of calling printf()
+ * directly; the driver loop formats and prints the records while it is
+ * otherwise idle.
+ */
+static struct async_log log_ring;
+
 static void
 add_to_buffer(int item)
 {
-	printf("Item %d added to buffer at place %d\n", item, bufptr);
+	async_log(&log_ring, "Item %d added to buffer at place %d\n", item, bufptr);
 	buffer[bufptr] = item;
 	bufptr = (bufptr + 1) % BUFSIZE;
 }
@@ -60,7 +68,7 @@ get_from_buffer(void)
 {
 	int item;
 	item = buffer[bufptr];
-	printf("Item %d retrieved from buffer at place %d\n",
+	async_log(&log_ring, "Item %d retrieved from buffer at place %d\n",
 		item, bufptr);
 	bufptr = (bufptr + 1) % BUFSIZE;
 	return item;
@@ -70,14 +78,14 @@ static int
 produce_item(void)
 {
 	static int item = 0;
-	printf("Item %d produced\n", item);
+	async_log(&log_ring, "Item %d produced\n", item);
 	return item++;
 }
 
 static void
 consume_item(int item)
 {
-	printf("Item %d consumed\n", item);
+	async_log(&log_ring, "Item %d consumed\n", item);
 }
 
 static struct async_sem full, empty;
@@ -145,9 +153,12 @@ example_buffer(void)
 	struct async driver_pt;
 
 	async_init(&driver_pt);
+	async_log_init(&log_ring);
 
 	while (!driver_thread(&driver_pt)) {
 
+		async_log_drain(&log_ring, stdout);
+
 		/*
 		 * When running this example on a multitasking system, we must
 		 * give other processes a chance to run too and therefore we call
@@ -160,5 +171,6 @@ example_buffer(void)
 		usleep(10);
 #endif
 	}
+	async_log_drain(&log_ring, stdout);
 	return 0;
 }
@@ -0,0 +1,79 @@
+/**
+ * This example puts flow control in front of a simulated backend that
+ * slows down as more requests run on it at once. Clients are paced by a
+ * token bucket, and an AIMD limiter finds how many requests the backend
+ * can take before its latency exceeds the target.
+ *
+ * Time is simulated so the run is the same every time: each pass of the
+ * driver loop advances the clock by one millisecond.
+ */
+
+#include <stdio.h>
+
+#include "async-flow.h"
+
+#define NUM_CLIENTS 8
+#define REQUESTS_PER_CLIENT 10
+#define MS 1000000ULL
+
+static unsigned long long now;
+static struct async_bucket bucket;
+static struct async_aimd aimd;
+static unsigned served, peak;
+
+typedef struct {
+	async_state;
+	unsigned request;
+	unsigned ticket;
+	unsigned long long started, finish_at;
+} client_state;
+
+static async
+client(client_state *st)
+{
+	async_begin(st);
+
+	for (st->request = 0; st->request < REQUESTS_PER_CLIENT; ++st->request) {
+		await_bucket(&bucket, 1, now);
+		await_aimd(&aimd, 1, st->ticket);
+		st->started = now;
+
+		/* the backend takes 1ms, plus 1ms per request running alongside */
+		if (aimd.lim.in_use > peak)
+			peak = aimd.lim.in_use;
+		st->finish_at = now + aimd.lim.in_use * MS;
+		await(now >= st->finish_at);
+
+		signal_aimd(&aimd, 1, now - st->started);
+		++served;
+	}
+
+	async_end;
+}
+
+int
+example_flow(void)
+{
+	client_state clients[NUM_CLIENTS];
+	int i, running;
+
+	now = 0;
+	served = peak = 0;
+	/* 2000 requests per second, in bursts of at most 8 */
+	init_bucket(&bucket, 2000, 8, now);
+	/* keep the backend's latency within 3ms */
+	init_aimd(&aimd, 1, NUM_CLIENTS, 3 * MS);
+	for (i = 0; i < NUM_CLIENTS; ++i)
+		async_init(&clients[i]);
+
+	do {
+		running = 0;
+		for (i = 0; i < NUM_CLIENTS; ++i)
+			running += !client(&clients[i]);
+		now += MS;
+	} while (running);
+
+	printf("%u requests served in %llu ms, at most %u at once, final limit %u\n",
+	       served, now / MS, peak, aimd.lim.limit);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * This example sums a large array with await_map_reduce(). The array is
+ * split into chunks that workers sum in parallel, each into its own slot,
+ * and the partial sums are added up on the calling thread. A second,
+ * small array stays below the grain size and is summed inline.
+ */
+
+#include <stdio.h>
+
+#include "async-parallel.h"
+
+#define BIG 1000000
+#define SMALL 100
+#define GRAIN 10000
+
+struct sum {
+	const unsigned *data;
+	unsigned long long partial[ASYNC_PFOR_MAX_CHUNKS];
+	unsigned long long total;
+};
+
+static void
+sum_chunk(void *ctx, unsigned chunk, size_t begin, size_t end)
+{
+	struct sum *s = (struct sum *)ctx;
+	for (s->partial[chunk] = 0; begin < end; ++begin)
+		s->partial[chunk] += s->data[begin];
+}
+
+static void
+sum_reduce(void *ctx, unsigned nchunks)
+{
+	struct sum *s = (struct sum *)ctx;
+	for (s->total = 0; nchunks--; )
+		s->total += s->partial[nchunks];
+}
+
+typedef struct {
+	async_state;
+	struct async_pfor pf;
+	struct sum sum;
+	size_t n;
+} sum_state;
+
+static struct async_pool pool;
+
+static async
+sum_array(sum_state *st)
+{
+	async_begin(st);
+
+	await_map_reduce(&pool, &st->pf, st->n, GRAIN, sum_chunk, sum_reduce, &st->sum);
+
+	async_end;
+}
+
+int
+example_parallel(void)
+{
+	static unsigned data[BIG];
+	static sum_state big, small;
+	unsigned i;
+
+	for (i = 0; i < BIG; ++i)
+		data[i] = i;
+	if (async_pool_init(&pool, 4, 64) != 0) {
+		printf("could not start the worker pool\n");
+		return -1;
+	}
+	async_init(&big);
+	big.sum.data = data;
+	big.n = BIG;
+	async_init(&small);
+	small.sum.data = data;
+	small.n = SMALL;
+
+	while (!(sum_array(&big) & sum_array(&small)))
+		;
+
+	printf("sum of %u items is %llu, in %u chunks\n", BIG, big.sum.total, big.pf.nchunks);
+	printf("sum of %u items is %llu, in %u chunk\n", SMALL, small.sum.total, small.pf.nchunks);
+	async_pool_destroy(&pool);
+	return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * This example profiles a producer and a consumer sharing a semaphore.
+ * The producer takes 200 microseconds to make an item and the consumer 50
+ * to process one, so the consumer spends most of its time waiting for
+ * items. Every resume is made through async_profile(),
+ * and the report at the end shows, for each await, how often and how long
+ * the subroutines waited there and how many resumes found nothing to do.
+ */
+
+#include <stdio.h>
+
+#include "async-profile.h"
+#include "async-sem.h"
+
+#define NUM_ITEMS 20
+
+static struct async_sem items;
+
+typedef struct {
+	async_state;
+	unsigned i;
+	unsigned long long next;
+} producer_state;
+
+static async
+producer(producer_state *st)
+{
+	async_begin(st);
+
+	for (st->i = 0; st->i < NUM_ITEMS; ++st->i) {
+		st->next = async_clock_ns() + 200000;
+		await(async_clock_ns() >= st->next);
+		signal_sem(&items);
+		/* let the consumer pick the item up */
+		async_yield;
+	}
+
+	async_end;
+}
+
+typedef struct {
+	async_state;
+	unsigned i;
+	unsigned long long next;
+} consumer_state;
+
+static async
+consumer(consumer_state *st)
+{
+	async_begin(st);
+
+	for (st->i = 0; st->i < NUM_ITEMS; ++st->i) {
+		await_sem(&items);
+		st->next = async_clock_ns() + 50000;
+		await(async_clock_ns() >= st->next);
+	}
+
+	async_end;
+}
+
+int
+example_profile(void)
+{
+	static struct async_profile prof;
+	struct async_probe producer_probe = { 0 }, consumer_probe = { 0 };
+	producer_state prod;
+	consumer_state cons;
+
+	async_profile_init(&prof);
+	init_sem(&items, 0);
+	async_init(&prod);
+	async_init(&cons);
+
+	while (!async_profile(&prof, &consumer_probe, consumer, &cons))
+		async_profile(&prof, &producer_probe, producer, &prod);
+
+	async_profile_report(&prof, stdout);
+	return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * This example shows a worker waiting on two work queues and an idle
+ * timeout at once with await_select(). Both queues are kept full, yet the
+ * worker alternates between them instead of always serving the first, and
+ * it stops once no work has arrived for 20 ms.
+ */
+
+#include <stdio.h>
+
+#include "async-select.h"
+
+#define NUM_JOBS 3
+
+static struct async_sem urgent, routine;
+
+typedef struct {
+	async_state;
+	struct async_select sel;
+	struct async_deadline idle;
+	int urgent, routine, timeout;
+	int which;
+} worker_state;
+
+static async
+worker(worker_state *st)
+{
+	async_begin(st);
+
+	async_select_clear(&st->sel);
+	st->urgent = async_select_sem(&st->sel, &urgent);
+	st->routine = async_select_sem(&st->sel, &routine);
+	st->timeout = async_select_deadline(&st->sel, &st->idle);
+
+	while (1) {
+		async_deadline_set(&st->idle, 20 * 1000000ULL);
+		await_select(&st->sel, st->which);
+		if (st->which == st->timeout)
+			break;
+		printf("worker took a job from the %s queue\n",
+		       st->which == st->urgent ? "urgent" : "routine");
+	}
+	printf("worker idle for 20 ms, stopping\n");
+
+	async_end;
+}
+
+int
+example_select(void)
+{
+	worker_state st;
+	int i;
+
+	init_sem(&urgent, 0);
+	init_sem(&routine, 0);
+	for (i = 0; i < NUM_JOBS; ++i) {
+		signal_sem(&urgent);
+		signal_sem(&routine);
+	}
+
+	async_init(&st);
+	while (!worker(&st))
+		;
+	return 0;
+}
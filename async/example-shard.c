@@ -0,0 +1,113 @@
+/**
+ * This example partitions a stream of keys across thread-per-core shards.
+ * Every shard generates keys and sends each one to the shard that owns it
+ * (key % NUM_SHARDS), and every shard adds up the keys it owns. Shards
+ * only ever touch their own totals; keys cross between them through the
+ * shards' mailboxes.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+
+#include "async-shard.h"
+
+#define NUM_SHARDS 4
+#define KEYS_PER_SHARD 1000
+
+struct shard_totals {
+	unsigned received;
+	unsigned long long sum;
+};
+
+static struct shard_totals totals[NUM_SHARDS];
+
+typedef struct {
+	async_state;
+	struct async_shard *shard;
+	unsigned key;
+} sender_state;
+
+typedef struct {
+	async_state;
+	struct async_shard *shard;
+	void *msg;
+} receiver_state;
+
+static async
+sender(sender_state *st)
+{
+	async_begin(st);
+
+	for (st->key = st->shard->id * KEYS_PER_SHARD;
+	     st->key < (st->shard->id + 1) * KEYS_PER_SHARD; ++st->key) {
+		await_shard_send(st->shard, st->key % NUM_SHARDS, (void *)(size_t)st->key);
+	}
+
+	async_end;
+}
+
+static async
+receiver(receiver_state *st)
+{
+	struct shard_totals *t = &totals[st->shard->id];
+
+	async_begin(st);
+
+	while (1) {
+		await_shard_recv(st->shard, st->msg);
+		t->sum += (size_t)st->msg;
+		async_atomic_store(&t->received, t->received + 1);
+	}
+
+	async_end;
+}
+
+/* The driver loop of one shard, running on the shard's own thread. */
+static void
+shard_loop(struct async_shard *shard)
+{
+	sender_state snd;
+	receiver_state rcv;
+
+	async_init(&snd);
+	async_init(&rcv);
+	snd.shard = rcv.shard = shard;
+
+	while (!async_shard_stopping(shard)) {
+		sender(&snd);
+		receiver(&rcv);
+	}
+}
+
+int
+example_shard(void)
+{
+	static struct async_shards group;
+	unsigned i, done;
+
+	if (async_shards_start(&group, NUM_SHARDS, shard_loop, NULL) != 0) {
+		printf("could not start the shards\n");
+		return -1;
+	}
+
+	/* each shard owns an equal share of all the keys sent */
+	do {
+#ifdef _WIN32
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+		for (i = 0, done = 0; i < NUM_SHARDS; ++i)
+			done += async_atomic_load(&totals[i].received) == KEYS_PER_SHARD;
+	} while (done < NUM_SHARDS);
+	async_shards_stop(&group);
+
+	for (i = 0; i < NUM_SHARDS; ++i)
+		printf("shard %u received %u keys adding up to %llu\n",
+		       i, totals[i].received, totals[i].sum);
+	return 0;
+}
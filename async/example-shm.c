@@ -0,0 +1,102 @@
+/**
+ * This example passes messages between two processes over a shared-memory
+ * channel. The parent forks a child that sends a series of messages while
+ * the parent receives them; each side drives one async subroutine and
+ * puts its driver loop to sleep on the channel whenever that subroutine
+ * is waiting.
+ *
+ * The channel needs Linux, so elsewhere the example only says so.
+ */
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include <sys/wait.h>
+
+#include "async-shm.h"
+
+#define NUM_MESSAGES 16
+
+typedef struct {
+	async_state;
+	struct async_shm_chan *ch;
+	unsigned i;
+	char buf[64];
+	unsigned len;
+	int rc;
+} shm_state;
+
+static async
+sender(shm_state *st)
+{
+	async_begin(st);
+
+	for (st->i = 0; st->i < NUM_MESSAGES; ++st->i) {
+		st->len = (unsigned)sprintf(st->buf, "message %u", st->i) + 1;
+		await_shm_send(st->ch, st->buf, st->len, st->rc);
+		if (st->rc < 0) {
+			async_exit;
+		}
+	}
+
+	async_end;
+}
+
+static async
+receiver(shm_state *st)
+{
+	async_begin(st);
+
+	for (st->i = 0; st->i < NUM_MESSAGES; ++st->i) {
+		await_shm_recv(st->ch, st->buf, st->len);
+		printf("received \"%s\"\n", st->buf);
+	}
+
+	async_end;
+}
+
+int
+example_shm(void)
+{
+	struct async_shm_chan ch;
+	shm_state st;
+	pid_t child;
+
+	/* a small ring, so the sender has to wait for the receiver */
+	if (async_shm_create(&ch, 4, sizeof(st.buf)) != 0) {
+		printf("could not create the channel\n");
+		return -1;
+	}
+	async_init(&st);
+	st.ch = &ch;
+
+	fflush(stdout);
+	child = fork();
+	if (child < 0) {
+		async_shm_close(&ch);
+		return -1;
+	}
+	if (child == 0) {
+		while (!sender(&st))
+			async_shm_wait_send(&ch);
+		_exit(0);
+	}
+
+	while (!receiver(&st))
+		async_shm_wait_recv(&ch);
+	waitpid(child, NULL, 0);
+	async_shm_close(&ch);
+	return 0;
+}
+
+#else /* __linux__ */
+
+int
+example_shm(void)
+{
+	printf("the shared-memory channel requires Linux\n");
+	return 0;
+}
+
+#endif /* __linux__ */
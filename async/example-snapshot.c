@@ -0,0 +1,79 @@
+/**
+ * This example stops a multi-step job halfway, saves its async state with
+ * async_snapshot_save(), and then simulates a restart: the state is wiped,
+ * restored from the snapshot with async_snapshot_load(), and the job
+ * continues with the step after the last one it finished.
+ *
+ * The state holds a pointer, which would be stale in a new process, so a
+ * relocate hook points it at this process's copy of the data.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "async-snapshot.h"
+
+#define SNAPSHOT_FILE "example-snapshot.snap"
+#define SNAPSHOT_VERSION 1
+#define NUM_STEPS 6
+
+static const char *job_name = "nightly report";
+
+typedef struct {
+	async_state;
+	const char *name;
+	unsigned step;
+} job_state;
+
+static void
+relocate_job(void *state, void *ctx)
+{
+	((job_state *)state)->name = (const char *)ctx;
+}
+
+static async
+job(job_state *st)
+{
+	async_begin(st);
+
+	for (st->step = 1; st->step <= NUM_STEPS; ++st->step) {
+		printf("%s: step %u done\n", st->name, st->step);
+		async_yield;
+	}
+
+	async_end;
+}
+
+int
+example_snapshot(void)
+{
+	struct async_snapshot snap;
+	job_state st;
+	int i;
+
+	async_snapshot_init(&snap, SNAPSHOT_VERSION);
+	async_snapshot_add(&snap, 1, &st, relocate_job, (void *)job_name);
+
+	async_init(&st);
+	st.name = job_name;
+	for (i = 0; i < NUM_STEPS / 2; ++i)
+		job(&st);
+	if (async_snapshot_save(&snap, SNAPSHOT_FILE) != 0) {
+		printf("could not save the snapshot\n");
+		return -1;
+	}
+	printf("saved the job after step %u, restarting\n", st.step);
+
+	/* the restarted process starts from scratch... */
+	memset(&st, 0, sizeof(st));
+	/* ...unless a snapshot of the right version is found */
+	if (async_snapshot_load(&snap, SNAPSHOT_FILE) != 1) {
+		printf("no snapshot, starting over\n");
+		async_init(&st);
+		st.name = job_name;
+	}
+	while (!job(&st))
+		;
+	remove(SNAPSHOT_FILE);
+	return 0;
+}
@@ -2,7 +2,17 @@
 #define __EXAMPLES_H__
 
 extern void example_small(int);
+extern int example_blocking(void);
 extern int example_buffer(void);
 extern int example_codelock(void);
+extern int example_shard(void);
+extern int example_flow(void);
+extern int example_shm(void);
+extern int example_parallel(void);
+extern int example_select(void);
+extern int example_snapshot(void);
+extern int example_budget(void);
+extern int example_profile(void);
+extern int example_batch(void);
 
 #endif
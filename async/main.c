@@ -5,5 +5,15 @@ int main(void) {
 	example_small(200);
 	example_buffer();
 	example_codelock();
+	example_blocking();
+	example_shard();
+	example_flow();
+	example_shm();
+	example_parallel();
+	example_select();
+	example_snapshot();
+	example_budget();
+	example_profile();
+	example_batch();
 	return 0;
 }
\ No newline at end of file